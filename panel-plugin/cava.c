@@ -1,11 +1,13 @@
 #include <math.h>
 
 #include <gtk/gtk.h>
+#include <libxfce4ui/libxfce4ui.h>
 #include <libxfce4util/libxfce4util.h>
 #include "cava/util.h"
 #include "cava/input/pulse.h"
 #include "cava/input/pipewire.h"
 #include "cava/cavacore.h"
+#include "filters.h"
 #include "plugin.h"
 
 #ifdef __GNUC__
@@ -16,49 +18,84 @@
 #define GCC_UNUSED /* nothing */
 #endif
 
-int *bars;
-int *previous_frame;
-float *bars_left, *bars_right;
-double *cava_out;
-float *bars_raw;
-int number_of_bars;
-int raw_number_of_bars;
-int output_channels;
-int timeout_id;
+// settings changes that need a new state are applied once they stop coming
+// for this long, in milliseconds
+#define REBUILD_DELAY 150
 
-void config_colors(CavaPlugin *c) {
-    GdkRGBA fg;
-    CavaSettings *s;
+// bars per channel beyond the most the dialog used to allow are analyzed in
+// high density mode whether or not it is set, only that mode fits them all
+#define DENSE_BARS 512
+
+// Everything that depends on the bar and channel configuration: the cava
+// plan, the bar buffers and the foreground pattern. A new state is built on
+// a worker thread when the settings change while the old one keeps
+// rendering, and replaces it at the start of a frame.
+struct CavaState {
+    struct cava_plan *plan;
+    cairo_pattern_t *foreground;
+    int *bars;
+    int *previous_frame;
+    double *cava_out;
+    float *bars_work; // scaled and filtered bars, one channel after the other
+    // bars_work indices averaged into each bar, those of bar n start at
+    // bar_source_start[n]
+    int *bar_sources, *bar_source_start;
+    FilterScratch filter; // for channel_bars bars
+    float idle_bar_height;
+    int number_of_bars;
+    int raw_number_of_bars;
+    int channel_bars;
+    int output_channels;
+    // the channels the plan analyzes, see cava_options
+    unsigned int channel_mask;
+    int downmix;
+    int framerate;
+};
+
+// what a state is built from, copied on the GTK thread so that the worker
+// does not race with the settings dialog
+typedef struct {
+    CavaPlugin *cava;
+    CavaSettings settings;
+    guint rate;
+    int channels;
+    int format;
     GtkAllocation alloc;
+    // what the worker built, or NULL and why it could not
+    CavaState *state;
+    gchar *error;
+} CavaBuild;
+
+static cairo_pattern_t *create_foreground(CavaSettings *s,
+        GtkAllocation *alloc) {
+    GdkRGBA fg;
+    cairo_pattern_t *foreground;
     double offset, step;
     gint i, x0, y0, x1, y1;
-    GtkWidget *display = c->display;
-    gtk_widget_get_allocation(display, &alloc);
-    s = &c->settings;
     if (s->gradient) {
         switch (s->orientation) {
             case ORIENT_BOTTOM:
             case ORIENT_SPLIT_H:
                 x0 = x1 = y1 = 0;
-                y0 = alloc.height;
+                y0 = alloc->height;
                 break;
             case ORIENT_TOP:
                 x0 = x1 = y0 = 0;
-                y1 = alloc.height;
+                y1 = alloc->height;
                 break;
             case ORIENT_LEFT:
             case ORIENT_SPLIT_V:
                 x0 = y0 = y1 = 0;
-                x1 = alloc.width;
+                x1 = alloc->width;
                 break;
             case ORIENT_RIGHT:
                 x1 = y0 = y1 = 0;
-                x0 = alloc.width;
+                x0 = alloc->width;
                 break;
             default:
                 exit(EXIT_FAILURE);
         }
-        c->foreground = cairo_pattern_create_linear(x0, y0, x1, y1);
+        foreground = cairo_pattern_create_linear(x0, y0, x1, y1);
         if (s->orientation == ORIENT_SPLIT_H || 
                 s->orientation == ORIENT_SPLIT_V) {
             offset = step = 0.0625;
@@ -68,7 +105,7 @@ void config_colors(CavaPlugin *c) {
                 else
                     i = 7 - n;
                 rgba_parse(&fg, s->gradient_colors[i]);
-                cairo_pattern_add_color_stop_rgba(c->foreground, offset, 
+                cairo_pattern_add_color_stop_rgba(foreground, offset, 
                         fg.red, fg.green, fg.blue, fg.alpha);
                 offset += step;
             }
@@ -77,18 +114,18 @@ void config_colors(CavaPlugin *c) {
             offset = step = 0.125;
             for (int n = 0; n < 8; n++) {
                 rgba_parse(&fg, s->gradient_colors[n]);
-                cairo_pattern_add_color_stop_rgba(c->foreground, offset, 
+                cairo_pattern_add_color_stop_rgba(foreground, offset, 
                         fg.red, fg.green, fg.blue, fg.alpha);
                 offset += step;
             }
         }
     }
     else if (s->horizontal_gradient) {
-        c->foreground = cairo_pattern_create_linear(0, 0, alloc.width, 0);
+        foreground = cairo_pattern_create_linear(0, 0, alloc->width, 0);
         offset = 0.125;
         for (int n = 0; n < 8; n++) {
             rgba_parse(&fg, s->horizontal_gradient_colors[n]);
-            cairo_pattern_add_color_stop_rgba(c->foreground, offset, 
+            cairo_pattern_add_color_stop_rgba(foreground, offset, 
                     fg.red, fg.green, fg.blue, fg.alpha);
             offset += 0.125;
         }
@@ -96,15 +133,32 @@ void config_colors(CavaPlugin *c) {
     else {
         // solid color
         rgba_parse(&fg, s->foreground);
-        c->foreground = cairo_pattern_create_rgba(
+        foreground = cairo_pattern_create_rgba(
                 fg.red, fg.green, fg.blue, fg.alpha);
     }
+    return foreground;
+}
+
+void config_colors(CavaPlugin *c) {
+    GtkAllocation alloc;
+    CavaState *st = c->state;
+    if (st == NULL)
+        return;
+    // the state being built has the colors from before
+    if (c->builder)
+        c->rebuild_pending = TRUE;
+    gtk_widget_get_allocation(c->display, &alloc);
+    cairo_pattern_destroy(st->foreground);
+    st->foreground = create_foreground(&c->settings, &alloc);
 }
 
 static gboolean draw_cava(GtkWidget *display, cairo_t *cr, CavaPlugin *c) {
     CavaSettings *s;
     GtkAllocation alloc;
     gint x, y, w, h, bar_width, bar_spacing;
+    CavaState *st = c->state;
+    int *bars = st->bars;
+    uint64_t start = c->stats ? stats_now() : 0;
 
     // bar size
     s = &c->settings;
@@ -113,10 +167,10 @@ static gboolean draw_cava(GtkWidget *display, cairo_t *cr, CavaPlugin *c) {
     gtk_widget_get_allocation(display, &alloc);
 
     // foreground color
-    cairo_set_source(cr, c->foreground);
+    cairo_set_source(cr, st->foreground);
 
     // draw the bars
-    for (int n = 0; n < number_of_bars; n++) {
+    for (int n = 0; n < st->number_of_bars; n++) {
         if (bars[n] == 0)
             continue;
         x = y = w = h = 0;
@@ -162,63 +216,139 @@ static gboolean draw_cava(GtkWidget *display, cairo_t *cr, CavaPlugin *c) {
         cairo_fill(cr);
     }
 
+    if (c->stats) {
+        stats_record_since(c->stats, STATS_DRAW, start);
+        c->stats->repaints++;
+    }
     return FALSE;
 }
 
-static float *monstercat_filter(float *_bars, int _number_of_bars, int waves, 
-        double monstercat, int height) {
-    int z;
-    int m_y, de;
-    float height_normalizer = 1.0;
-    monstercat = (100.0 - (monstercat / 3.0)) / 100.0;
-    if (height > 1000) {
-        height_normalizer = height / 912.76;
-    }
-    if (waves > 0) {
-        for (z = 0; z < _number_of_bars; z++) { // waves
-            _bars[z] = _bars[z] / 1.25;
-            // if (_bars[z] < 1) _bars[z] = 1;
-            for (m_y = z - 1; m_y >= 0; m_y--) {
-                de = z - m_y;
-                _bars[m_y] = max(
-                        _bars[z] - height_normalizer * pow(de, 2), _bars[m_y]);
-            }
-            for (m_y = z + 1; m_y < _number_of_bars; m_y++) {
-                de = m_y - z;
-                _bars[m_y] = max(
-                        _bars[z] - height_normalizer * pow(de, 2), _bars[m_y]);
-            }
-        }
+// process [scale]: cava output to bar heights in pixels
+static void scale_bars(const double *restrict in, float *restrict out,
+        int count, double sensitivity, int dimension_value) {
+    for (int n = 0; n < count; n++)
+        out[n] = in[n] * sensitivity * dimension_value;
+}
+
+// process [remix]: gathers the filtered channel bars into the displayed
+// bars through the maps built by config_bar_map(), clamping them to
+// [low, high] pixels. Returns whether any bar differs from the last frame.
+static gboolean remix_bars(CavaState *st, float low, float high) {
+    int changed = 0;
+    for (int n = 0; n < st->number_of_bars; n++) {
+        int first = st->bar_source_start[n];
+        int last = st->bar_source_start[n + 1];
+        float value = 0;
+        for (int i = first; i < last; i++)
+            value += st->bars_work[st->bar_sources[i]];
+        value /= last - first;
+        value = value < low ? low : value > high ? high : value;
+        st->bars[n] = value;
+        changed |= st->bars[n] != st->previous_frame[n];
     }
-    else if (monstercat > 0) {
-        for (z = 0; z < _number_of_bars; z++) {
-            // if (_bars[z] < 1)_bars[z] = 1;
-            for (m_y = z - 1; m_y >= 0; m_y--) {
-                de = z - m_y;
-                _bars[m_y] = max(
-                        _bars[z] / pow(monstercat * 1.5, de), _bars[m_y]);
-            }
-            for (m_y = z + 1; m_y < _number_of_bars; m_y++) {
-                de = m_y - z;
-                _bars[m_y] = max(
-                        _bars[z] / pow(monstercat * 1.5, de), _bars[m_y]);
-            }
-        }
+    return changed;
+}
+
+// sample n of the buffer the audio thread writes into, whichever format it has
+static inline double audio_sample(const struct audio_data *audio, int n) {
+    if (audio->cava_in_s16)
+        return audio->cava_in_s16[n];
+    return audio->cava_in[n];
+}
+
+// (re)allocates the buffer the audio thread writes into for size samples.
+// 16 bit audio is kept as it is, to be passed to cava_execute_s16.
+// Must be called with the audio lock held once the audio thread runs.
+static void alloc_cava_in(struct audio_data *audio, int size) {
+    free(audio->cava_in);
+    free(audio->cava_in_s16);
+    audio->cava_in = NULL;
+    audio->cava_in_s16 = NULL;
+    audio->cava_buffer_size = size;
+    // samples counted into the old buffer would overrun a smaller one
+    audio->samples_counter = 0;
+    if (audio->format == 16)
+        audio->cava_in_s16 = (int16_t *)calloc(size, sizeof(int16_t));
+    else
+        audio->cava_in = (double *)calloc(size, sizeof(double));
+}
+
+static void state_free(CavaState *st) {
+    cava_destroy(st->plan);
+    cairo_pattern_destroy(st->foreground);
+    free(st->cava_out);
+    free(st->bars);
+    free(st->bars_work);
+    free(st->bar_sources);
+    free(st->bar_source_start);
+    free(st->previous_frame);
+    filter_scratch_free(&st->filter);
+    g_slice_free(CavaState, st);
+}
+
+// Records the stages of the execution that just ran, and how long its
+// samples waited for it. Stages that did not run, like the FFTs in between
+// two hops, are left out. Must be called with the audio lock held.
+static void record_execute(CavaStats *stats, CavaState *st, int waveform) {
+    if (stats->handoff_ns) {
+        stats_record_since(stats, STATS_HANDOFF, stats->handoff_ns);
+        stats->handoff_ns = 0;
+    }
+    if (waveform)
+        return;
+    for (int stage = 0; stage < CAVA_STAGE_COUNT; stage++) {
+        double time = st->plan->stage_time[stage];
+        if (time > 0)
+            stats_record(stats, STATS_WINDOW + stage, time * 1e9);
     }
-    return _bars;
 }
 
+static gboolean install_state(CavaPlugin *c, CavaState *st,
+        const gchar *error);
+static void build_free(CavaBuild *b);
+
 static gboolean exec_cava(CavaPlugin *c) {
     CavaSettings *s = &c->settings;
     struct audio_data *audio = &c->audio;
     static gint sleep_counter = 0;
     gboolean silence = TRUE;
+    // a state built by the worker is swapped in between two frames
+    if (g_atomic_int_get(&c->built)) {
+        g_atomic_int_set(&c->built, FALSE);
+        CavaBuild *b = g_thread_join(c->builder);
+        c->builder = NULL;
+        if (c->rebuild_pending) {
+            c->rebuild_pending = FALSE;
+            rebuild_cava(c);
+        }
+        gboolean restart = install_state(c, b->state, b->error);
+        build_free(b);
+        // a new frame rate replaces this timeout
+        if (restart)
+            return FALSE;
+    }
+    CavaState *st = c->state;
+    CavaStats *stats = c->stats;
+    if (stats)
+        stats_frame(stats, s->framerate);
     if (s->sleep_timer > 0) {
-        for (int n = 0; n < audio->input_buffer_size; n++) {
-            if (audio->cava_in[n]) {
+        if (audio->plan) {
+            pthread_mutex_lock(&audio->lock);
+            if (!st->plan->pending_silence) {
                 sleep_counter = 0;
                 silence = FALSE;
-                break;
+            }
+            pthread_mutex_unlock(&audio->lock);
+        }
+        else {
+            // cava_in is sized for the plan and can be the smaller one
+            int size = MIN(audio->input_buffer_size, audio->cava_buffer_size);
+            for (int n = 0; n < size; n++) {
+                if (audio_sample(audio, n)) {
+                    sleep_counter = 0;
+                    silence = FALSE;
+                    break;
+                }
             }
         }
         if (silence)
@@ -236,182 +366,107 @@ static gboolean exec_cava(CavaPlugin *c) {
         dimension_value = alloc.width;
     if (dimension_value < 2)
         return TRUE;
+    double *cava_out = st->cava_out;
     pthread_mutex_lock(&audio->lock);
     double sensitivity = (double)s->sensitivity / 100;
     if (s->waveform) {
-        for (int n = 0; n < audio->samples_counter; n++) {
-            for (int i = number_of_bars - 1; i > 0; i--) {
+        // the mean of all channels of a frame
+        int channels = audio->channels;
+        for (int n = 0; n + channels <= audio->samples_counter; n += channels) {
+            for (int i = st->number_of_bars - 1; i > 0; i--) {
                 cava_out[i] = cava_out[i - 1];
             }
-            if (audio->channels == 2) {
-                cava_out[0] =
-                    sensitivity * (audio->cava_in[n] / 2 + 
-                            audio->cava_in[n + 1] / 2);
-                n++;
-            }
-            else {
-                cava_out[0] = sensitivity * audio->cava_in[n];
-            }
+            double sum = 0;
+            for (int ch = 0; ch < channels; ch++)
+                sum += audio_sample(audio, n + ch);
+            cava_out[0] = sensitivity * sum / channels;
         }
     }
+    else if (audio->plan) {
+        cava_execute_pending(st->plan, cava_out);
+    }
+    else if (audio->cava_in_s16) {
+        cava_execute_s16(
+                audio->cava_in_s16, audio->samples_counter, cava_out, st->plan);
+    }
     else {
         cava_execute(
-                audio->cava_in, audio->samples_counter, cava_out, c->plan);
+                audio->cava_in, audio->samples_counter, cava_out, st->plan);
     }
     if (audio->samples_counter > 0) {
         audio->samples_counter = 0;
     }
+    if (stats)
+        record_execute(stats, st, s->waveform);
     pthread_mutex_unlock(&audio->lock);
-    for (int n = 0; n < raw_number_of_bars; n++) {
-        if (!s->waveform) {
-            cava_out[n] *= sensitivity;
-        } 
-        else {
+    uint64_t post_start = stats ? stats_now() : 0;
+    if (s->waveform) {
+        for (int n = 0; n < st->raw_number_of_bars; n++) {
             if (cava_out[n] > 1.0)
                 sensitivity *= 0.999;
             else
                 sensitivity *= 1.00001;
             if (s->orientation != ORIENT_SPLIT_H)
                 cava_out[n] = (cava_out[n] + 1.0) / 2.0;
-        }
-        cava_out[n] *= dimension_value;
-        if (s->orientation == ORIENT_SPLIT_H ||
-                s->orientation == ORIENT_SPLIT_V) {
-            //cava_out[n] /= 2;
-        }
-        if (s->waveform) {
-            bars_raw[n] = cava_out[n];
+            cava_out[n] *= dimension_value;
+            st->bars_work[n] = cava_out[n];
         }
     }
-    double eq_ratio = 0;
-    double eq_key;
-    if (!s->waveform) {
-        if (s->equalizer && (number_of_bars / output_channels > 0)) {
-            eq_ratio = (double)(EQUALIZER_KEY_COUNT / 
-                    ((double)(number_of_bars / output_channels)));
-        }
-        if (audio->channels == 2) {
-            for (int n = 0; n < number_of_bars / output_channels; n++) {
-                if (s->equalizer) {
-                    eq_key = s->equalizer_keys[(int)floor(((double)n) * eq_ratio)];
-                    cava_out[n] *= eq_key;
-                }
-                bars_left[n] = cava_out[n];
-            }
-            for (int n = 0; n < number_of_bars / output_channels; n++) {
-                if (s->equalizer) {
-                    eq_key = s->equalizer_keys[(int)floor(((double)n) * eq_ratio)];
-                    cava_out[n + number_of_bars / output_channels] *= eq_key;
-                }
-                bars_right[n] = cava_out[n + number_of_bars / output_channels];
-            }
-        }
-        else {
-            for (int n = 0; n < number_of_bars; n++) {
-                if (s->equalizer) {
-                    eq_key = s->equalizer_keys[(int)floor(((double)n) * eq_ratio)];
-                    cava_out[n] *= eq_key;
-                }
-                bars_raw[n] = cava_out[n];
-            }
-        }
+    else {
+        scale_bars(cava_out, st->bars_work, st->raw_number_of_bars,
+                sensitivity, dimension_value);
         // process [filter]
         if (s->monstercat) {
-            if (audio->channels == 2) {
-                bars_left =
-                    monstercat_filter(
-                            bars_left, number_of_bars / output_channels,
-                            s->waves, s->monstercat, dimension_value);
-                bars_right =
-                    monstercat_filter(
-                            bars_right, number_of_bars / output_channels,
-                            s->waves, s->monstercat, dimension_value);
-            }
-            else {
-                bars_raw = monstercat_filter(bars_raw, number_of_bars, 
-                        s->waves, s->monstercat, dimension_value);
-            }
-        }
-        if (audio->channels == 2) {
-            if (s->stereo) {
-                // mirroring stereo channels
-                for (int n = 0; n < number_of_bars; n++) {
-                    if (n < number_of_bars / 2) {
-                        if (s->reverse) {
-                            bars_raw[n] = bars_left[n];
-                        }
-                        else {
-                            bars_raw[n] = bars_left[number_of_bars / 2 - n - 1];
-                        }
-                    }
-                    else {
-                        if (s->reverse) {
-                            bars_raw[n] = bars_right[number_of_bars - n - 1];
-                        }
-                        else {
-                            bars_raw[n] = bars_right[n - number_of_bars / 2];
-                        }
-                    }
-                }
-            }
-            else {
-                // stereo mono output
-                for (int n = 0; n < number_of_bars; n++) {
-                    if (s->reverse) {
-                        if (s->mono_option == AVERAGE) {
-                            bars_raw[number_of_bars - n - 1] =
-                                (bars_left[n] + bars_right[n]) / 2;
-                        }
-                        else if (s->mono_option == LEFT) {
-                            bars_raw[number_of_bars - n - 1] = bars_left[n];
-                        }
-                        else if (s->mono_option == RIGHT) {
-                            bars_raw[number_of_bars - n - 1] = bars_right[n];
-                        }
-                    }
-                    else {
-                        if (s->mono_option == AVERAGE) {
-                            bars_raw[n] = (bars_left[n] + bars_right[n]) / 2;
-                        }
-                        else if (s->mono_option == LEFT) {
-                            bars_raw[n] = bars_left[n];
-                        }
-                        else if (s->mono_option == RIGHT) {
-                            bars_raw[n] = bars_right[n];
-                        }
-                    }
-                }
+            for (int ch = 0; ch < st->raw_number_of_bars / st->channel_bars;
+                    ch++) {
+                monstercat_filter(&st->filter,
+                        st->bars_work + ch * st->channel_bars,
+                        st->channel_bars, s->waves, s->monstercat,
+                        dimension_value);
             }
         }
     }
-    int re_paint = 0;
-    for (int n = 0; n < number_of_bars; n++) {
-        bars[n] = bars_raw[n];
-        // show idle bar heads
-        if (bars[n] < 1 && s->waveform == 0 && s->show_idle_bar_heads == 1)
-            bars[n] = 1;
-        if (bars[n] != previous_frame[n])
-            re_paint = 1;
-    }
-    if (re_paint) {
+    gboolean changed = remix_bars(st,
+            s->waveform ? -dimension_value : st->idle_bar_height,
+            dimension_value);
+    if (stats)
+        stats_record_since(stats, STATS_POST, post_start);
+    if (changed) {
         gtk_widget_queue_draw(c->display);
-        memcpy(previous_frame, bars, number_of_bars * sizeof(int));
+        memcpy(st->previous_frame, st->bars, st->number_of_bars * sizeof(int));
     }
     return TRUE;
 }
 
+// Stops visualizing and frees the state, waiting for a build in progress.
 void free_cava(CavaPlugin *c) {
     DBG(".");
-    g_source_remove(timeout_id);
-    cava_destroy(c->plan);
-    cairo_pattern_destroy(c->foreground);
-    free(c->plan);
-    free(bars_left);
-    free(bars_right);
-    free(cava_out);
-    free(bars);
-    free(bars_raw);
-    free(previous_frame);
+    if (c->rebuild_id) {
+        g_source_remove(c->rebuild_id);
+        c->rebuild_id = 0;
+    }
+    if (c->builder) {
+        CavaBuild *b = g_thread_join(c->builder);
+        if (b->state)
+            state_free(b->state);
+        build_free(b);
+        c->builder = NULL;
+        c->built = FALSE;
+    }
+    if (c->timeout_id) {
+        g_source_remove(c->timeout_id);
+        c->timeout_id = 0;
+    }
+    pthread_mutex_lock(&c->audio.lock);
+    c->audio.plan = NULL;
+    c->audio.stats = NULL;
+    pthread_mutex_unlock(&c->audio.lock);
+    g_free(c->stats);
+    c->stats = NULL;
+    if (c->state) {
+        state_free(c->state);
+        c->state = NULL;
+    }
 }
 
 static void init_audio(CavaPlugin *c) {
@@ -427,10 +482,10 @@ static void init_audio(CavaPlugin *c) {
     audio->IEEE_FLOAT = 0;
     audio->autoconnect = 0;
     audio->input_buffer_size = BUFFER_SIZE * audio->channels;
-    audio->cava_buffer_size = 16384;
-    audio->cava_in = (double *)malloc(
-            audio->cava_buffer_size * sizeof(double));
-    memset(audio->cava_in, 0, sizeof(int) * audio->cava_buffer_size);
+    audio->cava_in = NULL;
+    audio->cava_in_s16 = NULL;
+    audio->plan = NULL;
+    audio->stats = NULL;
     audio->threadparams = 0;
     audio->terminate = 0;
     pthread_t p_thread;
@@ -445,8 +500,6 @@ static void init_audio(CavaPlugin *c) {
             if (strcmp(audio->source, "auto") == 0) {
                 getPulseDefaultSink((void *)audio);
             }
-            thr_id = pthread_create(&p_thread, NULL, input_pulse, 
-                    (void *)audio);
             break;
         case INPUT_PIPEWIRE:
             audio->format = s->sample_bits;
@@ -455,6 +508,18 @@ static void init_audio(CavaPlugin *c) {
             audio->active = s->active;
             audio->remix = s->remix;
             audio->virtual_node = s->virtual;
+            break;
+        default:
+            exit(EXIT_FAILURE); // Can't happen.
+    }
+    // the sample format has to be known before the audio thread writes
+    alloc_cava_in(audio, 16384);
+    switch (s->method) {
+        case INPUT_PULSE:
+            thr_id = pthread_create(&p_thread, NULL, input_pulse, 
+                    (void *)audio);
+            break;
+        case INPUT_PIPEWIRE:
             thr_id = pthread_create(&p_thread, NULL, input_pipewire, 
                     (void *)audio);
             break;
@@ -486,76 +551,390 @@ static void init_audio(CavaPlugin *c) {
     }
 }
 
-void config_cava(CavaPlugin *c) {
-    DBG(".");
+// Which side of the panel a channel goes to in the grouped layout, -1 for
+// the left, 1 for the right and 0 for both. Channels are taken to be in the
+// usual order of 2.1 up to 7.1: front left and right, then the center and
+// the LFE, then pairs of left and right ones, the last one on its own if
+// there is no pair for it.
+static int channel_side(int ch, int channels) {
+    int centers = channels == 3 || channels == 5 ? 1 : channels >= 6 ? 2 : 0;
+    if (ch < 2)
+        return ch == 0 ? -1 : 1;
+    if (ch < 2 + centers)
+        return 0;
+    if (ch == channels - 1 && (channels - 2 - centers) % 2)
+        return 0;
+    return (ch - 2 - centers) % 2 ? 1 : -1;
+}
+
+// Adds the bars at index src of the channels on side, or of all of them for
+// a side of 0, to the sources of a displayed bar. Only the channels in mask
+// are analyzed, their bars follow one another.
+static int add_group(int *sources, int count, int src, int side,
+        int channels, unsigned int mask, int channel_bars) {
+    int first = 0;
+    for (int ch = 0; ch < channels; ch++) {
+        if (!(mask & 1u << ch))
+            continue;
+        int ch_side = channel_side(ch, channels);
+        if (side == 0 || ch_side == 0 || ch_side == side)
+            sources[count++] = first + src;
+        first += channel_bars;
+    }
+    return count;
+}
+
+// Which channels the plan needs to analyze for mono output, 0 for all of
+// them. Left or right only needs the channels on that side.
+static unsigned int mono_channel_mask(CavaSettings *s, int channels) {
+    unsigned int mask = 0;
+    if (s->mono_option == AVERAGE)
+        return 0;
+    for (int ch = 0; ch < channels; ch++) {
+        int side = channel_side(ch, channels);
+        if (side == 0 || side == (s->mono_option == LEFT ? -1 : 1))
+            mask |= 1u << ch;
+    }
+    return mask;
+}
+
+// Builds the maps from displayed bars to channel bars for the layout,
+// stereo, mono and reverse settings, so that exec_cava can remix a frame
+// without checking any of them.
+static void config_bar_map(CavaState *st, CavaSettings *s, int channels) {
+    int number_of_bars = st->number_of_bars;
+    int channel_bars = st->channel_bars;
+    int half = number_of_bars / 2;
+    unsigned int mask = st->plan->channel_mask;
+    int src;
+    int *bar_sources = (int *)malloc(
+            (size_t)number_of_bars * channels * sizeof(int));
+    int *bar_source_start = (int *)malloc((number_of_bars + 1) * sizeof(int));
+    int count = 0;
+    for (int n = 0; n < number_of_bars; n++) {
+        bar_source_start[n] = count;
+        if (s->waveform || channels == 1) {
+            bar_sources[count++] = n;
+        }
+        else if (st->downmix) {
+            // the mean of the channels is all there is
+            bar_sources[count++] = s->reverse ? number_of_bars - n - 1 : n;
+        }
+        else if (s->layout == LAYOUT_SEPARATE && 
+                st->output_channels == channels) {
+            // one channel after the other
+            src = n % channel_bars;
+            if (s->reverse)
+                src = channel_bars - src - 1;
+            bar_sources[count++] = n / channel_bars * channel_bars + src;
+        }
+        else if (st->output_channels == 2) {
+            // mirroring the left and right channels
+            if (n < half)
+                count = add_group(bar_sources, count,
+                        s->reverse ? n : half - n - 1, -1,
+                        channels, mask, channel_bars);
+            else
+                count = add_group(bar_sources, count,
+                        s->reverse ? number_of_bars - n - 1 : n - half, 1,
+                        channels, mask, channel_bars);
+        }
+        else {
+            // mono output
+            src = s->reverse ? number_of_bars - n - 1 : n;
+            count = add_group(bar_sources, count, src,
+                    s->mono_option == LEFT ? -1 : 
+                    s->mono_option == RIGHT ? 1 : 0,
+                    channels, mask, channel_bars);
+        }
+    }
+    bar_source_start[number_of_bars] = count;
+    st->bar_sources = bar_sources;
+    st->bar_source_start = bar_source_start;
+    // show idle bar heads
+    st->idle_bar_height = s->show_idle_bar_heads ? 1.0 : 0.0;
+}
+
+void config_equalizer(CavaPlugin *c) {
     CavaSettings *s = &c->settings;
+    if (c->state == NULL)
+        return;
+    if (s->equalizer)
+        cava_set_equalizer(
+                c->state->plan, s->equalizer_keys, EQUALIZER_KEY_COUNT);
+    else
+        cava_set_equalizer(c->state->plan, NULL, 0);
+}
+
+// Points the audio thread to the buffers of the current plan. Must be
+// called with the audio lock held.
+static void attach_plan(CavaPlugin *c) {
     struct audio_data *audio = &c->audio;
-    // force stereo if only one channel is available
-    if (s->stereo && audio->channels == 1)
-        s->stereo = 0;
-    output_channels = 1;
-    if (s->stereo && s->bars > 1)
-        output_channels = 2;
-    // getting numbers of bars
-    number_of_bars = s->bars;
-    if (s->stereo)
-        number_of_bars = s->bars / output_channels * output_channels;
-    raw_number_of_bars = (number_of_bars / output_channels) * audio->channels;
-    if (s->waveform) {
-        raw_number_of_bars = number_of_bars;
-    }
-    double noise_reduction = (double)s->noise_reduction / 100.0;
-    struct cava_plan *plan = c->plan = 
-        cava_init(number_of_bars / output_channels, audio->rate, 
-                audio->channels, s->autosens, noise_reduction,
-                s->lower_cutoff_freq, s->higher_cutoff_freq);
-    if (plan->status == -1) {
-        fprintf(stderr, "Error initializing cava . %s", plan->error_message);
+    struct cava_plan *plan = c->state->plan;
+    // cava_in holds samples of every channel before they are decimated
+    int size = plan->FFTbufferSize * plan->input_channels * plan->decimation;
+    if (size != audio->cava_buffer_size)
+        alloc_cava_in(audio, size);
+    // the audio thread writes 16 and 32 bit samples directly into the plan,
+    // the waveform and other formats still go through cava_in
+    audio->plan = NULL;
+    if (!c->settings.waveform && (audio->format == 16 || audio->format == 32))
+        audio->plan = plan;
+}
+
+// Reconfigures the cava plan of the current state for the current settings,
+// which keeps its FFT plans, sample history and smoothing state. The bar
+// count stays the one the state was built for.
+void config_plan(CavaPlugin *c) {
+    CavaSettings *s = &c->settings;
+    CavaState *st = c->state;
+    struct audio_data *audio = &c->audio;
+    if (st == NULL)
+        return;
+    struct cava_options options = {
+        .number_of_bars = st->number_of_bars / st->output_channels,
+        .rate = audio->rate,
+        .channels = audio->channels,
+        .autosens = s->autosens,
+        .noise_reduction = (double)s->noise_reduction / 100.0,
+        .low_cut_off = s->lower_cutoff_freq,
+        .high_cut_off = s->higher_cutoff_freq,
+        // 16 bit audio stays 16 bit up to the FFTs
+        .history_format = audio->cava_in_s16 ? 
+            CAVA_HISTORY_S16 : CAVA_HISTORY_DOUBLE,
+        .window = s->window,
+        .overlap = s->overlap,
+        .engine = s->engine,
+        .high_density = s->high_density ||
+            st->number_of_bars / st->output_channels > DENSE_BARS,
+        .workers = s->workers,
+        // the bar map is built for these
+        .channel_mask = st->channel_mask,
+        .downmix = st->downmix,
+        .timing = s->statistics,
+    };
+    // the audio thread may be writing into the plan
+    pthread_mutex_lock(&audio->lock);
+    st->plan = cava_reconfigure(st->plan, &options);
+    if (st->plan->status == -1) {
+        fprintf(stderr, "Error initializing cava . %s",
+                st->plan->error_message);
         exit(EXIT_FAILURE);
     }
-    if (plan->input_buffer_size != audio->cava_buffer_size) {
-        pthread_mutex_lock(&audio->lock);
-        audio->cava_buffer_size = plan->input_buffer_size;
-        free(audio->cava_in);
-        audio->cava_in = (double *)malloc(
-                audio->cava_buffer_size * sizeof(double));
-        memset(audio->cava_in, 0, sizeof(double) * audio->cava_buffer_size);
-        pthread_mutex_unlock(&audio->lock);
+    attach_plan(c);
+    pthread_mutex_unlock(&audio->lock);
+    config_equalizer(c);
+}
+
+// Starts collecting statistics from scratch if the statistics setting is
+// on, or stops it, and has the plan time its stages accordingly.
+void config_stats(CavaPlugin *c) {
+    CavaStats *stats = NULL;
+    if (c->settings.statistics)
+        stats = g_new0(CavaStats, 1);
+    pthread_mutex_lock(&c->audio.lock);
+    CavaStats *old = c->stats;
+    c->stats = c->audio.stats = stats;
+    pthread_mutex_unlock(&c->audio.lock);
+    g_free(old);
+    config_plan(c);
+}
+
+// Makes st the current state, the previous one is freed. Returns whether
+// the frame timeout was replaced, which happens for the first state and
+// when the frame rate changes. A build that failed passes a NULL st and
+// why, the current state then keeps running and the error is reported.
+static gboolean install_state(CavaPlugin *c, CavaState *st,
+        const gchar *error) {
+    if (st == NULL) {
+        g_warning("%s", error);
+        if (c->settings_dialog)
+            xfce_dialog_show_warning(GTK_WINDOW(c->settings_dialog), error,
+                    "%s", _("The new settings could not be applied"));
+        return FALSE;
     }
-    bars_left = (float *)malloc(
-            number_of_bars / output_channels * sizeof(float));
-    bars_right = (float *)malloc(
-            number_of_bars / output_channels * sizeof(float));
-    memset(bars_left, 0, sizeof(float) * number_of_bars / output_channels);
-    memset(bars_right, 0, sizeof(float) * number_of_bars / output_channels);
-    bars = (int *)malloc(number_of_bars * sizeof(int));
-    bars_raw = (float *)malloc(number_of_bars * sizeof(float));
-    previous_frame = (int *)malloc(number_of_bars * sizeof(int));
-    cava_out = (double *)malloc(number_of_bars * audio->channels / 
-            output_channels * sizeof(double));
-    memset(bars, 0, sizeof(int) * number_of_bars);
-    memset(bars_raw, 0, sizeof(float) * number_of_bars);
-    memset(previous_frame, 0, sizeof(int) * number_of_bars);
-    memset(cava_out, 0, sizeof(double) * number_of_bars * audio->channels / 
-            output_channels);
-    // checking if audio thread has exited unexpectedly
+    CavaState *old = c->state;
+    pthread_mutex_lock(&c->audio.lock);
+    // the new plan carries on from the samples and sensitivity of the old one
+    if (old)
+        cava_inherit(st->plan, old->plan);
+    c->state = st;
+    attach_plan(c);
+    pthread_mutex_unlock(&c->audio.lock);
+    // settings of the plan may have changed while the state was being built
+    config_plan(c);
+    gboolean restart = old == NULL || old->framerate != st->framerate;
+    if (old)
+        state_free(old);
+    if (restart) {
+        if (c->timeout_id)
+            g_source_remove(c->timeout_id);
+        c->timeout_id = g_timeout_add(
+                1000 / st->framerate, (GSourceFunc)exec_cava, c);
+    }
+    return restart;
+}
+
+// Copies what a state is built from, the strings that building does not
+// read are left out.
+static CavaBuild *build_new(CavaPlugin *c) {
+    CavaSettings *s = &c->settings;
+    struct audio_data *audio = &c->audio;
+    CavaBuild *b = g_slice_new0(CavaBuild);
+    b->cava = c;
     pthread_mutex_lock(&audio->lock);
+    // checking if audio thread has exited unexpectedly
     if (audio->terminate == 1) {
         fprintf(stderr, "Audio thread exited unexpectedly. %s\n", 
                 audio->error_message);
         exit(EXIT_FAILURE);
     }
+    b->rate = audio->rate;
+    b->channels = audio->channels;
+    b->format = audio->format;
     pthread_mutex_unlock(&audio->lock);
-    config_colors(c);
+    // force stereo if only one channel is available
+    if (s->stereo && b->channels == 1)
+        s->stereo = 0;
+    b->settings = *s;
+    b->settings.source = NULL;
+    b->settings.background = NULL;
+    b->settings.border_color = NULL;
+    b->settings.theme = NULL;
+    b->settings.css = NULL;
+    b->settings.foreground = g_strdup(s->foreground);
+    b->settings.gradient_colors = g_strdupv(s->gradient_colors);
+    b->settings.horizontal_gradient_colors = 
+        g_strdupv(s->horizontal_gradient_colors);
+    gtk_widget_get_allocation(c->display, &b->alloc);
+    return b;
+}
 
-    int timeout = 1000 / c->settings.framerate;
-    timeout_id = g_timeout_add(timeout, (GSourceFunc)exec_cava, c);
+static void build_free(CavaBuild *b) {
+    g_free(b->error);
+    g_free(b->settings.foreground);
+    g_strfreev(b->settings.gradient_colors);
+    g_strfreev(b->settings.horizontal_gradient_colors);
+    g_slice_free(CavaBuild, b);
+}
+
+// Builds a state from b. Doesn't touch the plugin, so that it can run on
+// the worker thread.
+// Returns NULL and sets error if the settings can't be analyzed, in which
+// case the running state is kept.
+static CavaState *state_new(CavaBuild *b, gchar **error) {
+    CavaSettings *s = &b->settings;
+    CavaState *st = g_slice_new0(CavaState);
+    // the separate layout shows every channel, stereo mirrors two sides
+    st->output_channels = 1;
+    if (s->layout == LAYOUT_SEPARATE && b->channels > 1 && 
+            s->bars >= b->channels)
+        st->output_channels = b->channels;
+    else if (s->stereo && s->bars > 1)
+        st->output_channels = 2;
+    // getting numbers of bars
+    st->number_of_bars = 
+        s->bars / st->output_channels * st->output_channels;
+    st->channel_bars = st->number_of_bars / st->output_channels;
+    // mono output only needs the FFTs of the channels it shows, the
+    // waveform does not use the plan
+    if (st->output_channels == 1 && b->channels > 1 && !s->waveform) {
+        st->channel_mask = mono_channel_mask(s, b->channels);
+        st->downmix = s->downmix && s->mono_option == AVERAGE;
+    }
+    struct cava_options options = {
+        .number_of_bars = st->number_of_bars / st->output_channels,
+        .rate = b->rate,
+        .channels = b->channels,
+        .autosens = s->autosens,
+        .noise_reduction = (double)s->noise_reduction / 100.0,
+        .low_cut_off = s->lower_cutoff_freq,
+        .high_cut_off = s->higher_cutoff_freq,
+        // the same choice as alloc_cava_in()
+        .history_format = b->format == 16 ? 
+            CAVA_HISTORY_S16 : CAVA_HISTORY_DOUBLE,
+        .window = s->window,
+        .overlap = s->overlap,
+        .engine = s->engine,
+        .high_density = s->high_density ||
+            st->number_of_bars / st->output_channels > DENSE_BARS,
+        .workers = s->workers,
+        .channel_mask = st->channel_mask,
+        .downmix = st->downmix,
+        .timing = s->statistics,
+    };
+    st->plan = cava_init_with_options(&options);
+    if (st->plan->status == -1) {
+        *error = g_strdup_printf("Error initializing cava. %s",
+                st->plan->error_message);
+        state_free(st);
+        return NULL;
+    }
+    // bars of each channel the plan analyzes
+    st->raw_number_of_bars = st->channel_bars * st->plan->audio_channels;
+    if (s->waveform) {
+        st->channel_bars = st->raw_number_of_bars = st->number_of_bars;
+    }
+    int out_size = st->number_of_bars / st->output_channels *
+        st->plan->audio_channels;
+    st->bars = (int *)calloc(st->number_of_bars, sizeof(int));
+    st->previous_frame = (int *)calloc(st->number_of_bars, sizeof(int));
+    st->cava_out = (double *)calloc(out_size, sizeof(double));
+    st->bars_work = (float *)calloc(st->raw_number_of_bars, sizeof(float));
+    if (filter_scratch_init(&st->filter, st->channel_bars) == -1) {
+        *error = g_strdup("Error allocating the smoothing filters");
+        state_free(st);
+        return NULL;
+    }
+    config_bar_map(st, s, b->channels);
+    st->foreground = create_foreground(s, &b->alloc);
+    st->framerate = s->framerate;
+    return st;
+}
+
+static gpointer build_thread(CavaBuild *b) {
+    b->state = state_new(b, &b->error);
+    // picked up by the next exec_cava, which joins the thread for b
+    g_atomic_int_set(&b->cava->built, TRUE);
+    return b;
+}
+
+static gboolean start_build(CavaPlugin *c) {
+    c->rebuild_id = 0;
+    // one build at a time, the next one starts when this one is swapped in
+    if (c->builder) {
+        c->rebuild_pending = TRUE;
+        return FALSE;
+    }
+    c->builder = g_thread_new(
+            "cava-config", (GThreadFunc)build_thread, build_new(c));
+    return FALSE;
+}
+
+// Rebuilds the state for the current settings on a worker thread, once they
+// have not changed for REBUILD_DELAY, while the current state keeps
+// rendering.
+void rebuild_cava(CavaPlugin *c) {
+    DBG(".");
+    if (c->rebuild_id)
+        g_source_remove(c->rebuild_id);
+    c->rebuild_id = g_timeout_add(REBUILD_DELAY, (GSourceFunc)start_build, c);
 }
 
 void init_cava(CavaPlugin *c) {
     DBG(".");
     init_audio(c);
-    config_cava(c);
+    CavaBuild *b = build_new(c);
+    gchar *error = NULL;
+    CavaState *st = state_new(b, &error);
+    if (st == NULL) {
+        // there is no state to keep yet
+        fprintf(stderr, "%s\n", error);
+        exit(EXIT_FAILURE);
+    }
+    install_state(c, st, NULL);
+    build_free(b);
+    config_stats(c);
     c->initialized = TRUE;
     g_signal_connect(G_OBJECT(c->display), "draw", G_CALLBACK(draw_cava), c);
 }
@@ -2,10 +2,13 @@
 #ifndef M_PI
 #define M_PI 3.1415926535897932385
 #endif
-#include <fftw3.h>
 #include <math.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #ifdef __ANDROID__
 #include <jni.h>
 struct cava_plan *plan;
@@ -13,27 +16,477 @@ double *cava_in;
 double *cava_out;
 #endif
 
-struct cava_plan *cava_init(int number_of_bars, unsigned int rate, int channels, int autosens,
-                            double noise_reduction, int low_cut_off, int high_cut_off) {
-    struct cava_plan *p = malloc(sizeof(struct cava_plan));
-    p->status = 0;
+// windows one channel of the s16 history into out, oldest first, converting it on the way
+static inline __attribute__((always_inline)) void window_s16(const struct cava_plan *p,
+                                                             const int16_t *restrict history,
+                                                             const double *restrict window,
+                                                             double *restrict out) {
+    // the ring is as long as the window, and wraps at the oldest sample
+    int start = p->history_pos;
+    int first = p->FFTbufferSize - start;
+    for (int i = 0; i < first; i++)
+        out[i] = window[i] * history[start + i];
+    for (int i = first; i < p->FFTbufferSize; i++)
+        out[i] = window[i] * history[i - first];
+}
 
-    // sanity checks:
-    if (channels < 1 || channels > 2) {
-        snprintf(p->error_message, 1024,
-                 "cava_init called with illegal number of channels: %d, number of channels "
-                 "supported are "
-                 "1 and 2",
-                 channels);
-        p->status = -1;
-        return p;
+// windows one channel of a history of doubles into out, oldest first. the ring is size samples
+// long, as long as the window, and start is its oldest one
+static inline __attribute__((always_inline)) void window_ring(const double *restrict history,
+                                                              const double *restrict window,
+                                                              int size, int start,
+                                                              double *restrict out) {
+    int first = size - start;
+    for (int i = 0; i < first; i++)
+        out[i] = window[i] * history[start + i];
+    for (int i = first; i < size; i++)
+        out[i] = window[i] * history[i - first];
+}
+
+// bins of a Goertzel filterbank that are computed together, each in its own lane of the
+// vector registers
+#define CAVA_GOERTZEL_LANES 4
+
+// computes the DFT bins[0..count) of in, of size samples, into out, which is laid out like
+// the output of the FFT it replaces. coeffs holds 2 cos w, cos w and sin w of each bin
+static void goertzel(const double *restrict in, int size, const int *bins,
+                     const double *coeffs, int count, cava_complex *out) {
+    for (int b = 0; b < count; b += CAVA_GOERTZEL_LANES) {
+        double c[CAVA_GOERTZEL_LANES], s1[CAVA_GOERTZEL_LANES] = {0},
+                                       s2[CAVA_GOERTZEL_LANES] = {0};
+        // lanes past the last bin repeat it
+        for (int l = 0; l < CAVA_GOERTZEL_LANES; l++)
+            c[l] = coeffs[3 * (b + l < count ? b + l : count - 1)];
+        for (int i = 0; i < size; i++) {
+            double x = in[i];
+            for (int l = 0; l < CAVA_GOERTZEL_LANES; l++) {
+                double s = x + c[l] * s1[l] - s2[l];
+                s2[l] = s1[l];
+                s1[l] = s;
+            }
+        }
+        // the bin is s1 - e^-jw * s2, up to a phase that the magnitude does not see
+        for (int l = 0; l < CAVA_GOERTZEL_LANES && b + l < count; l++) {
+            const double *k = coeffs + 3 * (b + l);
+            out[bins[b + l]][0] = s1[l] - k[1] * s2[l];
+            out[bins[b + l]][1] = k[2] * s2[l];
+        }
     }
-    if (rate < 1 || rate > 384000) {
-        snprintf(p->error_message, 1024, "cava_init called with illegal sample rate: %d\n", rate);
-        p->status = -1;
-        return p;
+}
+
+// bars that come from the bass FFT. bass_cut_off_bar can count the cut off above the last bar
+static inline int bass_bar_count(const struct cava_plan *p) {
+    return p->bass_cut_off_bar < p->number_of_bars ? p->bass_cut_off_bar : p->number_of_bars;
+}
+
+// fills bands with the weighted magnitudes of one FFT's output for the bars first to last in
+// high density mode, see cava_plan.dense_weights
+static void dense_bands(const struct cava_plan *p, cava_complex *out, int first, int last,
+                        double *restrict bands) {
+    if (first >= last)
+        return;
+
+    // the bars share most of their bins, so each magnitude is only taken once, in place of the
+    // real part of its bin. they are nowhere near overflowing, which hypot guards against at a
+    // cost
+    for (int i = p->FFTbuffer_lower_cut_off[first]; i <= p->FFTbuffer_upper_cut_off[last - 1];
+         i++)
+        out[i][0] = sqrt(out[i][0] * out[i][0] + out[i][1] * out[i][1]);
+
+    for (int n = first; n < last; n++) {
+        const double *restrict weights = p->dense_weights + p->dense_start[n];
+        const cava_complex *m = out + p->FFTbuffer_lower_cut_off[n];
+        int count = p->dense_start[n + 1] - p->dense_start[n];
+        double sum = 0;
+        for (int k = 0; k < count; k++)
+            sum += weights[k] * m[k][0];
+        bands[n] = sum;
+    }
+}
+
+// fills bands with the magnitudes of one FFT's output summed up for the bars first to last
+static void fft_bands(const struct cava_plan *p, cava_complex *out, int first, int last,
+                      double *restrict bands) {
+    if (p->high_density) {
+        dense_bands(p, out, first, last, bands);
+        return;
+    }
+    for (int n = first; n < last; n++) {
+        double temp = 0;
+
+        // process: add upp FFT values within bands
+        for (int i = p->FFTbuffer_lower_cut_off[n]; i <= p->FFTbuffer_upper_cut_off[n]; i++)
+            temp += hypot(out[i][0], out[i][1]);
+
+        bands[n] = temp;
+    }
+}
+
+// each FFT only runs once its history has moved on by a hop since the last time, in between its
+// bars keep their magnitudes. an FFT without any bars does not run at all. sets bass and mid to
+// whether the bass and the mid and treble FFTs are due, and starts their next hops if they are
+static void due_ffts(struct cava_plan *p, int *bass, int *mid) {
+    *bass = p->bass_fresh >= p->bass_hop && p->bass_cut_off_bar > 0;
+    *mid = p->fresh >= p->hop && p->number_of_bars > p->bass_cut_off_bar;
+    if (*bass)
+        p->bass_fresh %= p->bass_hop;
+    if (*mid)
+        p->fresh %= p->hop;
+}
+
+// seconds on a clock that only moves forward, for the stage times
+static double clock_seconds(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// one FFT of an analysis for one channel, c, by itself: windows its history, runs the transform
+// and sums up its bars into cava_bands. the channels are independent of each other, so the
+// worker pool hands them out as they are. with timing, each FFT writes the times of its stages
+// to its own slot of job_time, so the threads never share one
+static void analyze_channel(struct cava_plan *p, int bass, int c) {
+    double *bands = p->cava_bands + c * p->number_of_bars;
+    double *time = NULL, start = 0;
+    if (p->timing) {
+        time = p->job_time + (bass * p->audio_channels + c) * CAVA_STAGE_SMOOTHING;
+        start = clock_seconds();
+    }
+
+    // the FFTs of the backend, see fft/fft.h, or the Goertzel filterbanks that replace them,
+    // see select_goertzel. in high density mode the FFT buffers are longer than the windows,
+    // the rest of them is never written and stays 0
+    double *in;
+    cava_complex *out;
+    if (bass) {
+        // the bass comes from its own, decimated history in either format
+        in = p->in_bass + c * p->bass_fft_size;
+        out = p->out_bass + c * p->bass_out_stride;
+        window_ring(p->bass_history + c * p->FFTbassbufferSize, p->bass_multiplier,
+                    p->FFTbassbufferSize, p->bass_pos, in);
+    } else {
+        in = p->in + c * p->fft_size;
+        out = p->out + c * p->out_stride;
+        if (p->history_s16)
+            window_s16(p, p->history_s16 + c * p->FFTbufferSize, p->multiplier, in);
+        else
+            window_ring(p->input_buffer + c * p->FFTbufferSize, p->multiplier,
+                        p->FFTbufferSize, p->history_pos, in);
+    }
+    if (time) {
+        double now = clock_seconds();
+        time[CAVA_STAGE_WINDOW] = now - start;
+        start = now;
+    }
+
+    if (bass && p->goertzel_bass_count)
+        goertzel(in, p->FFTbassbufferSize, p->goertzel_bass_bins, p->goertzel_bass_coeffs,
+                 p->goertzel_bass_count, out);
+    else if (bass)
+        cava_fft_execute(p->bass_fft, in, out);
+    else if (p->goertzel_count)
+        goertzel(in, p->FFTbufferSize, p->goertzel_bins, p->goertzel_coeffs, p->goertzel_count,
+                 out);
+    else
+        cava_fft_execute(p->fft, in, out);
+    if (time) {
+        double now = clock_seconds();
+        time[CAVA_STAGE_FFT] = now - start;
+        start = now;
+    }
+
+    if (bass)
+        fft_bands(p, out, 0, bass_bar_count(p), bands);
+    else
+        fft_bands(p, out, p->bass_cut_off_bar, p->number_of_bars, bands);
+    if (time)
+        time[CAVA_STAGE_BANDS] = clock_seconds() - start;
+}
+
+// fills cava_bands with the summed FFT magnitudes of each bar, before eq, running the FFTs that
+// are due for one channel after the other
+static void analyze(struct cava_plan *p) {
+    int bass, mid;
+    due_ffts(p, &bass, &mid);
+    for (int c = 0; mid && c < p->audio_channels; c++)
+        analyze_channel(p, 0, c);
+    for (int c = 0; bass && c < p->audio_channels; c++)
+        analyze_channel(p, 1, c);
+}
+
+// threads that run the FFTs of one analysis together with the thread executing the plan. the
+// FFTs of every backend are thread safe on separate buffers, so they all run the plan's
+// shared FFTs. a job is bass * CAVA_MAX_CHANNELS + channel, see analyze_channel. the jobs of an
+// analysis are claimed and counted under the lock, there are at most two per channel
+struct cava_pool {
+    pthread_t threads[CAVA_MAX_WORKERS];
+    int workers;
+    pthread_mutex_t lock;
+    pthread_cond_t start, done;
+    int quit;
+
+    struct cava_plan *plan;
+    int jobs[2 * CAVA_MAX_CHANNELS];
+    int job_count, next_job, finished;
+};
+
+// runs jobs of the current analysis until none are left, with the lock held
+static void pool_work(struct cava_pool *pool) {
+    while (pool->next_job < pool->job_count) {
+        struct cava_plan *p = pool->plan;
+        int job = pool->jobs[pool->next_job++];
+        pthread_mutex_unlock(&pool->lock);
+        analyze_channel(p, job / CAVA_MAX_CHANNELS, job % CAVA_MAX_CHANNELS);
+        pthread_mutex_lock(&pool->lock);
+        if (++pool->finished == pool->job_count)
+            pthread_cond_signal(&pool->done);
+    }
+}
+
+static void *pool_thread(void *arg) {
+    struct cava_pool *pool = arg;
+    pthread_mutex_lock(&pool->lock);
+    while (!pool->quit) {
+        if (pool->next_job < pool->job_count)
+            pool_work(pool);
+        else
+            pthread_cond_wait(&pool->start, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+// analyze with the FFTs spread over the worker pool, the calling thread takes jobs too
+static void analyze_parallel(struct cava_plan *p) {
+    int bass, mid;
+    due_ffts(p, &bass, &mid);
+    if (!bass && !mid)
+        return;
+
+    struct cava_pool *pool = p->pool;
+    pthread_mutex_lock(&pool->lock);
+    pool->plan = p;
+    pool->job_count = 0;
+    // the mid and treble FFT is the larger one, so it goes first
+    for (int c = 0; mid && c < p->audio_channels; c++)
+        pool->jobs[pool->job_count++] = c;
+    for (int c = 0; bass && c < p->audio_channels; c++)
+        pool->jobs[pool->job_count++] = CAVA_MAX_CHANNELS + c;
+    pool->next_job = 0;
+    pool->finished = 0;
+    pthread_cond_broadcast(&pool->start);
+    pool_work(pool);
+    while (pool->finished < pool->job_count)
+        pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void pool_destroy(struct cava_pool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 0; i < pool->workers; i++)
+        pthread_join(pool->threads[i], NULL);
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->done);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
+
+// starts a pool of workers threads, returns NULL if they could not be started
+static struct cava_pool *pool_create(int workers) {
+    struct cava_pool *pool = calloc(1, sizeof(struct cava_pool));
+    if (pool == NULL)
+        return NULL;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    for (; pool->workers < workers; pool->workers++) {
+        if (pthread_create(&pool->threads[pool->workers], NULL, pool_thread, pool) != 0) {
+            pool_destroy(pool);
+            return NULL;
+        }
+    }
+    return pool;
+}
+
+// sample types of the cava_write_* functions
+enum sample_type { SAMPLE_S16, SAMPLE_S32, SAMPLE_FLOAT, SAMPLE_DOUBLE };
+
+// reads sample i of data, scaled to the range cava expects, which is the one of 16 bit audio
+static inline __attribute__((always_inline)) double read_sample(const void *data,
+                                                                const enum sample_type type,
+                                                                ptrdiff_t i) {
+    switch (type) {
+    case SAMPLE_S16:
+        return ((const int16_t *)data)[i];
+    case SAMPLE_S32:
+        return (double)((const int32_t *)data)[i] / UINT16_MAX;
+    case SAMPLE_FLOAT:
+        return ((const float *)data)[i] * UINT16_MAX;
+    default:
+        return ((const double *)data)[i];
+    }
+}
+
+// bars of the filterbank that are filtered together, each in its own lane of the vector
+// registers
+#define CAVA_BIQUAD_LANES 4
+
+// runs frames at the analysis rate through the filterbank and its envelope followers
+static inline __attribute__((always_inline)) void
+run_biquads(struct cava_plan *p, const void *data, const enum sample_type type, int frames,
+            ptrdiff_t frame_stride, ptrdiff_t channel_stride) {
+    const int bars = p->number_of_bars;
+    for (int c = 0; c < p->audio_channels; c++) {
+        double *z1 = p->biquad_z1 + c * bars;
+        double *z2 = p->biquad_z2 + c * bars;
+        double *env = p->biquad_env + c * bars;
+        for (int b = 0; b < bars; b += CAVA_BIQUAD_LANES) {
+            double b0[CAVA_BIQUAD_LANES], a1[CAVA_BIQUAD_LANES], a2[CAVA_BIQUAD_LANES];
+            double release[CAVA_BIQUAD_LANES], s1[CAVA_BIQUAD_LANES], s2[CAVA_BIQUAD_LANES];
+            double e[CAVA_BIQUAD_LANES];
+            // lanes past the last bar repeat it
+            for (int l = 0; l < CAVA_BIQUAD_LANES; l++) {
+                int n = b + l < bars ? b + l : bars - 1;
+                b0[l] = p->biquad_b0[n];
+                a1[l] = p->biquad_a1[n];
+                a2[l] = p->biquad_a2[n];
+                release[l] = p->biquad_release[n];
+                s1[l] = z1[n];
+                s2[l] = z2[n];
+                e[l] = env[n];
+            }
+            for (ptrdiff_t f = 0; f < frames; f++) {
+                double x = read_sample(data, type, f * frame_stride + c * channel_stride);
+                // transposed direct form II
+                for (int l = 0; l < CAVA_BIQUAD_LANES; l++) {
+                    double y = b0[l] * x + s1[l];
+                    s1[l] = s2[l] - a1[l] * y;
+                    s2[l] = -b0[l] * x - a2[l] * y;
+                    double level = fabs(y);
+                    double fallen = e[l] * release[l];
+                    e[l] = level > fallen ? level : fallen;
+                }
+            }
+            // after silence the state would decay into subnormals, which are slow
+            for (int l = 0; l < CAVA_BIQUAD_LANES && b + l < bars; l++) {
+                z1[b + l] = fabs(s1[l]) < 1e-30 ? 0 : s1[l];
+                z2[b + l] = fabs(s2[l]) < 1e-30 ? 0 : s2[l];
+                env[b + l] = e[l] < 1e-30 ? 0 : e[l];
+            }
+        }
     }
+}
+
+// runs the filterbank over the frames that entered the history since the last execution and
+// takes the envelopes of the bars. this way it runs on the thread executing the plan, not on the
+// one writing the samples, which holds up the capture while it does. frames that a stall of
+// more than the length of the history pushed out of it again are skipped, as they are by the
+// FFTs
+static void analyze_biquad(struct cava_plan *p) {
+    double start = p->timing ? clock_seconds() : 0;
+    int frames = p->pending_samples / p->audio_channels;
+    int first = (p->history_pos - frames) & (p->FFTbufferSize - 1);
+    // the rings wrap around, so the frames are in up to two pieces
+    while (frames > 0) {
+        int piece = p->FFTbufferSize - first < frames ? p->FFTbufferSize - first : frames;
+        if (p->history_s16)
+            run_biquads(p, p->history_s16 + first, SAMPLE_S16, piece, 1, p->FFTbufferSize);
+        else
+            run_biquads(p, p->input_buffer + first, SAMPLE_DOUBLE, piece, 1, p->FFTbufferSize);
+        first = (first + piece) & (p->FFTbufferSize - 1);
+        frames -= piece;
+    }
+    memcpy(p->cava_bands, p->biquad_env, p->number_of_bars * p->audio_channels * sizeof(double));
+    // the filterbank takes the place of the FFTs, so it is timed as them
+    if (p->timing)
+        p->job_time[CAVA_STAGE_FFT] = clock_seconds() - start;
+}
+
+// picks the analysis for the plan's engine and workers
+static void select_analyze(struct cava_plan *p) {
+    if (p->engine == CAVA_ENGINE_BIQUAD)
+        p->analyze = analyze_biquad;
+    else if (p->pool)
+        p->analyze = analyze_parallel;
+    else
+        p->analyze = analyze;
+}
 
+// input above twice this rate is decimated by an integer factor, down to a rate between this
+// and twice this, before it is analyzed. nothing above 20 kHz is visualized, so this keeps the
+// FFT sizes, and the work per frame, the same at high sample rates
+#define CAVA_ANALYSIS_RATE_MIN 44100
+
+// taps of the anti-alias filter per factor of decimation. the filter is a Kaiser windowed sinc
+// with its -6 dB point at the output Nyquist frequency and a transition band from 0.45 to 0.55
+// of the output rate, which takes about 43 taps per factor for 70 dB of stopband attenuation
+#define CAVA_DECIMATOR_TAPS_PER_PHASE 44
+#define CAVA_DECIMATOR_ATTENUATION 70.0
+
+// output frames the decimator computes at once at most
+#define CAVA_DECIMATOR_BLOCK 256
+
+// frames of the input gathered into select_buffer at a time, when only some of its channels are
+// analyzed or they are mixed into one
+#define CAVA_SELECT_BLOCK 256
+
+static int decimation_for_rate(unsigned int rate) {
+    if (rate < 2 * CAVA_ANALYSIS_RATE_MIN)
+        return 1;
+    return rate / CAVA_ANALYSIS_RATE_MIN;
+}
+
+// the bass FFT runs on the history decimated by this factor, through a cascade of half-band
+// filters. it only resolves the bars below 100 Hz, and with a quarter of the size of the mid
+// and treble FFT it has the frequency resolution and time span that a bass FFT of twice
+// their size at the analysis rate would have
+#define CAVA_BASS_DECIMATION 8
+#define CAVA_HALF_BAND_STAGES 3
+
+// nonzero taps on either side of the center of the half-band filters, which have 4 * this - 1
+// taps. they pass up to 0.2 of their input rate and attenuate about 68 dB from 0.3 of it on,
+// which is where the band that the last stage folds onto the bass passband starts
+#define CAVA_HALF_BAND_PAIRS 11
+#define CAVA_HALF_BAND_TAPS (4 * CAVA_HALF_BAND_PAIRS - 1)
+
+// only bars ending below this fraction of the decimated rate are taken from the bass FFT
+#define CAVA_BASS_PASS_BAND 0.4
+
+// without an overlap, the mid and treble FFT runs on every execution with new samples, and the
+// bass FFT once its history has moved on by this fraction of its window, about 45 ms. that is
+// about every third frame at 60 fps, and a Hann window overlapping by three quarters still
+// weighs every sample the same
+#define CAVA_BASS_HOP_DIVISOR 4
+
+// most bins a Goertzel filterbank replacing an FFT computes, see select_goertzel
+#define CAVA_GOERTZEL_MAX_BINS 16
+
+// the envelope of a filterbank bar falls by 1/e in this many periods of its center
+// frequency, but not faster than in CAVA_BIQUAD_RELEASE_MIN seconds, so that it hardly
+// ripples between the peaks of a steady tone
+#define CAVA_BIQUAD_RELEASE_PERIODS 3.0
+#define CAVA_BIQUAD_RELEASE_MIN 0.01
+
+// highest overlap of the analysis windows in percent
+#define CAVA_OVERLAP_MAX 99
+
+// shape of the Kaiser window. its main lobe and side lobes are between the ones of the Hann
+// and the Blackman-Harris window
+#define CAVA_KAISER_BETA 8.6
+
+// in high density mode the bass FFT runs on its window zero padded to this many times its size,
+// and the mid and treble FFT on its window zero padded to CAVA_DENSE_PADDING times its size.
+// the padding adds no resolution, but the bins it adds in between follow the shape of the
+// spectrum, which linear interpolation between the bins of the window alone would flatten.
+// most of the narrow bars are in the bass, so it gets the most
+#define CAVA_DENSE_BASS_PADDING 4
+#define CAVA_DENSE_PADDING 2
+
+// size of the mid and treble FFT for a sample rate
+static int fft_buffer_size_for_rate(unsigned int rate) {
     int fft_buffer_size = 512;
 
     if (rate > 8125 && rate <= 16250)
@@ -49,133 +502,374 @@ struct cava_plan *cava_init(int number_of_bars, unsigned int rate, int channels,
     else if (rate > 300000)
         fft_buffer_size *= 64;
 
+    return fft_buffer_size;
+}
+
+// sanity checks, returns -1 and writes error_message if a parameter is illegal
+static int validate_parameters(char *error_message, int number_of_bars, unsigned int rate,
+                               int channels, unsigned int channel_mask, int low_cut_off,
+                               int high_cut_off, enum cava_window window, int overlap,
+                               enum cava_engine engine, int high_density, int workers,
+                               int parallel_fft_size) {
+    if (channels < 1 || channels > CAVA_MAX_CHANNELS) {
+        snprintf(error_message, 1024,
+                 "cava_init called with illegal number of channels: %d, number of channels "
+                 "supported are "
+                 "1 to %d",
+                 channels, CAVA_MAX_CHANNELS);
+        return -1;
+    }
+    if (channel_mask >> channels != 0) {
+        snprintf(error_message, 1024, "channel_mask 0x%x has channels the input does not have\n",
+                 channel_mask);
+        return -1;
+    }
+    if (rate < 1 || rate > 384000) {
+        snprintf(error_message, 1024, "cava_init called with illegal sample rate: %d\n", rate);
+        return -1;
+    }
+
+    // everything below is about the rate the FFTs run at, the errors report both
+    unsigned int analysis_rate = rate / decimation_for_rate(rate);
+    int fft_buffer_size = fft_buffer_size_for_rate(analysis_rate);
+
     if (number_of_bars < 1) {
-        snprintf(p->error_message, 1024,
+        snprintf(error_message, 1024,
                  "cava_init called with illegal number of bars: %d, number of channels must be "
                  "positive integer\n",
                  number_of_bars);
-        p->status = -1;
-        return p;
+        return -1;
     }
 
-    if (number_of_bars > fft_buffer_size / 2 + 1) {
-        snprintf(p->error_message, 1024,
-                 "cava_init called with illegal number of bars: %d, for %d sample rate number of "
-                 "bars can't be more than %d\n",
-                 number_of_bars, rate, fft_buffer_size / 2 + 1);
-        p->status = -1;
-        return p;
+    // the bars interpolate between the bins in high density mode, so they can outnumber them
+    int max_bars = high_density ? CAVA_DENSE_MAX_BARS : fft_buffer_size / 2 + 1;
+    if (number_of_bars > max_bars) {
+        snprintf(error_message, 1024,
+                 "cava_init called with illegal number of bars: %d, for %u sample rate (%u "
+                 "analysis rate) number of bars can't be more than %d\n",
+                 number_of_bars, rate, analysis_rate, max_bars);
+        return -1;
     }
     if (low_cut_off < 1 || high_cut_off < 1) {
-        snprintf(p->error_message, 1024, "low_cut_off must be a positive value\n");
-        p->status = -1;
-        return p;
+        snprintf(error_message, 1024, "low_cut_off must be a positive value\n");
+        return -1;
     }
     if (low_cut_off >= high_cut_off) {
-        snprintf(p->error_message, 1024, "high_cut_off must be a higher than low_cut_off\n");
-        p->status = -1;
-        return p;
+        snprintf(error_message, 1024, "high_cut_off must be a higher than low_cut_off\n");
+        return -1;
     }
-    if ((unsigned int)high_cut_off > rate / 2) {
-        snprintf(p->error_message, 1024,
-                 "high_cut_off can't be higher than sample rate / 2. (Nyquist Sampling Theorem)\n");
-        p->status = -1;
-        return p;
+    if ((unsigned int)high_cut_off > analysis_rate / 2) {
+        snprintf(error_message, 1024,
+                 "high_cut_off can't be higher than analysis rate / 2 (%u for %u sample rate). "
+                 "(Nyquist Sampling Theorem)\n",
+                 analysis_rate / 2, rate);
+        return -1;
     }
+    if (window < CAVA_WINDOW_HANN || window > CAVA_WINDOW_KAISER) {
+        snprintf(error_message, 1024, "cava_init called with illegal window: %d\n", window);
+        return -1;
+    }
+    if (engine < CAVA_ENGINE_FFT || engine > CAVA_ENGINE_BIQUAD) {
+        snprintf(error_message, 1024, "cava_init called with illegal engine: %d\n", engine);
+        return -1;
+    }
+    if (overlap < 0 || overlap > CAVA_OVERLAP_MAX) {
+        snprintf(error_message, 1024, "overlap must be between 0 and %d percent\n",
+                 CAVA_OVERLAP_MAX);
+        return -1;
+    }
+    if (workers < 0 || workers > CAVA_MAX_WORKERS) {
+        snprintf(error_message, 1024, "workers must be between 0 and %d\n", CAVA_MAX_WORKERS);
+        return -1;
+    }
+    if (parallel_fft_size < 0) {
+        snprintf(error_message, 1024, "parallel_fft_size can't be negative\n");
+        return -1;
+    }
+    return 0;
+}
 
-    p->number_of_bars = number_of_bars;
-    p->audio_channels = channels;
-    p->rate = rate;
-    p->autosens = 1;
-    p->sens_init = 1;
-    p->sens = 1.0;
-    p->autosens = autosens;
-    p->framerate = 75;
-    p->frame_skip = 1;
-    p->noise_reduction = noise_reduction;
-
-    int fftw_flag = FFTW_MEASURE;
-#ifdef __ANDROID__
-    fftw_flag = FFTW_ESTIMATE;
-#endif
+// the falloff gravity depends on the framerate estimate, which drifts a little every frame.
+// gravity_mod is proportional to framerate^-2.5, so recomputing it only after a change of
+// more than 0.5% keeps it within about 1.3% of its exact value. only falling bars use it, and
+// they differ from an exact computation by at most that fraction of their fall so far.
+#define CAVA_GRAVITY_FRAMERATE_TOLERANCE 0.005
 
-    p->FFTbassbufferSize = fft_buffer_size * 2;
-    p->FFTbufferSize = fft_buffer_size;
+// everything a plan points to is carved out of one allocation, the arena,
+// starting with the plan itself. every block starts on a cache line
+#define CAVA_ARENA_ALIGNMENT 64
 
-    p->input_buffer_size = p->FFTbassbufferSize * channels;
+static size_t arena_reserve(size_t *arena_size, size_t size) {
+    size_t offset = *arena_size;
+    *arena_size += (size + CAVA_ARENA_ALIGNMENT - 1) & ~(size_t)(CAVA_ARENA_ALIGNMENT - 1);
+    return offset;
+}
 
-    p->input_buffer = (double *)malloc(p->input_buffer_size * sizeof(double));
+// the FFT plans and windows of one pair of window and FFT sizes and window function. they never
+// change once made, so every plan with these points to the same copy, which lives as long as
+// they do
+struct cava_shared {
+    int FFTbassbufferSize;
+    int FFTbufferSize;
+    int bass_fft_size, fft_size;
+    enum cava_window window;
+    int refs;
+    struct cava_shared *next;
+
+    struct cava_fft *bass_fft;
+    struct cava_fft *fft;
+
+    double *bass_multiplier;
+    double *multiplier;
+    // mean of each window, which is what it scales a sine's magnitude by
+    double bass_window_gain, window_gain;
+
+    // the center tap of the half-band filters, then their nonzero taps on either side
+    double half_band_taps[CAVA_HALF_BAND_PAIRS + 1];
+};
+
+// modified Bessel function of the first kind of order 0, for the Kaiser window
+static double bessel_i0(double x) {
+    double sum = 1, term = 1;
+    for (int k = 1; term > sum * 1e-12; k++) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+    return sum;
+}
 
-    p->FFTbuffer_lower_cut_off = (int *)malloc((number_of_bars + 1) * sizeof(int));
-    p->FFTbuffer_upper_cut_off = (int *)malloc((number_of_bars + 1) * sizeof(int));
-    p->eq = (double *)malloc((number_of_bars + 1) * sizeof(double));
-    p->cut_off_frequency = (float *)malloc((number_of_bars + 1) * sizeof(float));
+// fills w with a window function of size n, returns its mean
+static double fill_window(double *w, int n, enum cava_window window) {
+    double sum = 0;
+    for (int i = 0; i < n; i++) {
+        double x = 2 * M_PI * i / (n - 1);
+        double r = 2.0 * i / (n - 1) - 1;
+        switch (window) {
+        case CAVA_WINDOW_BLACKMAN_HARRIS:
+            w[i] = 0.35875 - 0.48829 * cos(x) + 0.14128 * cos(2 * x) - 0.01168 * cos(3 * x);
+            break;
+        case CAVA_WINDOW_KAISER:
+            w[i] = bessel_i0(CAVA_KAISER_BETA * sqrt(1 - r * r)) / bessel_i0(CAVA_KAISER_BETA);
+            break;
+        default:
+            w[i] = 0.5 * (1 - cos(x));
+        }
+        sum += w[i];
+    }
+    return sum / n;
+}
 
-    p->cava_fall = (double *)malloc(number_of_bars * channels * sizeof(double));
-    p->cava_mem = (double *)malloc(number_of_bars * channels * sizeof(double));
-    p->cava_peak = (double *)malloc(number_of_bars * channels * sizeof(double));
-    p->prev_cava_out = (double *)malloc(number_of_bars * channels * sizeof(double));
+// Kaiser windowed sinc half-band filter, with unity gain at DC. every other tap is 0, so only
+// the center and the CAVA_HALF_BAND_PAIRS taps at odd distances from it are kept
+static void design_half_band(double *taps) {
+    double beta = 0.1102 * (68.0 - 8.7);
+    double center = (CAVA_HALF_BAND_TAPS - 1) / 2.0;
+    taps[0] = 0.5;
+    double sum = taps[0];
+    for (int i = 0; i < CAVA_HALF_BAND_PAIRS; i++) {
+        double t = 2 * i + 1;
+        double r = t / center;
+        double window = bessel_i0(beta * sqrt(1 - r * r)) / bessel_i0(beta);
+        taps[i + 1] = sin(M_PI * t / 2) / (M_PI * t) * window;
+        sum += 2 * taps[i + 1];
+    }
+    for (int i = 0; i < CAVA_HALF_BAND_PAIRS + 1; i++)
+        taps[i] /= sum;
+}
 
-    // Hann Window calculate multipliers
-    p->bass_multiplier = (double *)malloc(p->FFTbassbufferSize * sizeof(double));
-    p->multiplier = (double *)malloc(p->FFTbufferSize * sizeof(double));
-    for (int i = 0; i < p->FFTbassbufferSize; i++) {
-        p->bass_multiplier[i] = 0.5 * (1 - cos(2 * M_PI * i / (p->FFTbassbufferSize - 1)));
+// guards the list of shared resources and their reference counts. making and destroying FFTs
+// is not thread safe, see fft/fft.h, so it also serializes those
+static pthread_mutex_t cava_shared_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct cava_shared *cava_shared_list;
+
+// returns the shared resources for the window and FFT sizes of p and window with a reference
+// taken, making them if no plan has them yet. returns NULL if they could not be allocated
+static struct cava_shared *shared_acquire(const struct cava_plan *p, enum cava_window window) {
+    int fft_bass_buffer_size = p->FFTbassbufferSize;
+    int fft_buffer_size = p->FFTbufferSize;
+    int bass_fft_size = p->bass_fft_size;
+    int fft_size = p->fft_size;
+    pthread_mutex_lock(&cava_shared_lock);
+    struct cava_shared *s = cava_shared_list;
+    while (s != NULL &&
+           (s->FFTbassbufferSize != fft_bass_buffer_size ||
+            s->FFTbufferSize != fft_buffer_size || s->bass_fft_size != bass_fft_size ||
+            s->fft_size != fft_size || s->window != window))
+        s = s->next;
+    if (s != NULL) {
+        s->refs++;
+        pthread_mutex_unlock(&cava_shared_lock);
+        return s;
     }
-    for (int i = 0; i < p->FFTbufferSize; i++) {
-        p->multiplier[i] = 0.5 * (1 - cos(2 * M_PI * i / (p->FFTbufferSize - 1)));
+
+    // the struct and both windows in one block, like the arena of a plan
+    size_t size = 0;
+    arena_reserve(&size, sizeof(struct cava_shared));
+    size_t bass_multiplier_at = arena_reserve(&size, fft_bass_buffer_size * sizeof(double));
+    size_t multiplier_at = arena_reserve(&size, fft_buffer_size * sizeof(double));
+    char *block = NULL;
+    if (posix_memalign((void **)&block, CAVA_ARENA_ALIGNMENT, size) != 0) {
+        pthread_mutex_unlock(&cava_shared_lock);
+        return NULL;
     }
+    s = (struct cava_shared *)block;
+    s->FFTbassbufferSize = fft_bass_buffer_size;
+    s->FFTbufferSize = fft_buffer_size;
+    s->bass_fft_size = bass_fft_size;
+    s->fft_size = fft_size;
+    s->window = window;
+    s->refs = 1;
+    s->bass_multiplier = (double *)(block + bass_multiplier_at);
+    s->multiplier = (double *)(block + multiplier_at);
+
+    // window calculate multipliers
+    s->bass_window_gain = fill_window(s->bass_multiplier, fft_bass_buffer_size, window);
+    s->window_gain = fill_window(s->multiplier, fft_buffer_size, window);
+    design_half_band(s->half_band_taps);
 
     // BASS
-    p->in_bass_l = fftw_alloc_real(p->FFTbassbufferSize);
-    p->in_bass_l_raw = fftw_alloc_real(p->FFTbassbufferSize);
-    p->out_bass_l = fftw_alloc_complex(p->FFTbassbufferSize / 2 + 1);
-    p->p_bass_l =
-        fftw_plan_dft_r2c_1d(p->FFTbassbufferSize, p->in_bass_l, p->out_bass_l, fftw_flag);
+    s->bass_fft = cava_fft_plan(bass_fft_size);
 
     // MID + TREBLE
-    p->in_l = fftw_alloc_real(p->FFTbufferSize);
-    p->in_l_raw = fftw_alloc_real(p->FFTbufferSize);
-    p->out_l = fftw_alloc_complex(p->FFTbufferSize / 2 + 1);
-    p->p_l = fftw_plan_dft_r2c_1d(p->FFTbufferSize, p->in_l, p->out_l, fftw_flag);
-
-    memset(p->in_bass_l, 0, sizeof(double) * p->FFTbassbufferSize);
-    memset(p->in_l, 0, sizeof(double) * p->FFTbufferSize);
-    memset(p->in_bass_l_raw, 0, sizeof(double) * p->FFTbassbufferSize);
-    memset(p->in_l_raw, 0, sizeof(double) * p->FFTbufferSize);
-    memset(p->out_bass_l, 0, (p->FFTbassbufferSize / 2 + 1) * sizeof(fftw_complex));
-    memset(p->out_l, 0, (p->FFTbufferSize / 2 + 1) * sizeof(fftw_complex));
-    if (p->audio_channels == 2) {
-        // BASS
-        p->in_bass_r = fftw_alloc_real(p->FFTbassbufferSize);
-        p->in_bass_r_raw = fftw_alloc_real(p->FFTbassbufferSize);
-        p->out_bass_r = fftw_alloc_complex(p->FFTbassbufferSize / 2 + 1);
-        p->p_bass_r =
-            fftw_plan_dft_r2c_1d(p->FFTbassbufferSize, p->in_bass_r, p->out_bass_r, fftw_flag);
-
-        // MID + TREBLE
-        p->in_r = fftw_alloc_real(p->FFTbufferSize);
-        p->in_r_raw = fftw_alloc_real(p->FFTbufferSize);
-        p->out_r = fftw_alloc_complex(p->FFTbufferSize / 2 + 1);
-
-        p->p_r = fftw_plan_dft_r2c_1d(p->FFTbufferSize, p->in_r, p->out_r, fftw_flag);
-
-        memset(p->in_bass_r, 0, sizeof(double) * p->FFTbassbufferSize);
-        memset(p->in_r, 0, sizeof(double) * p->FFTbufferSize);
-        memset(p->in_bass_r_raw, 0, sizeof(double) * p->FFTbassbufferSize);
-        memset(p->in_r_raw, 0, sizeof(double) * p->FFTbufferSize);
-        memset(p->out_bass_r, 0, (p->FFTbassbufferSize / 2 + 1) * sizeof(fftw_complex));
-        memset(p->out_r, 0, (p->FFTbufferSize / 2 + 1) * sizeof(fftw_complex));
-    }
-
-    memset(p->input_buffer, 0, sizeof(double) * p->input_buffer_size);
-
-    memset(p->cava_fall, 0, sizeof(int) * number_of_bars * channels);
-    memset(p->cava_mem, 0, sizeof(double) * number_of_bars * channels);
-    memset(p->cava_peak, 0, sizeof(double) * number_of_bars * channels);
-    memset(p->prev_cava_out, 0, sizeof(double) * number_of_bars * channels);
-
-    // process: calculate cutoff frequencies and eq
+    s->fft = cava_fft_plan(fft_size);
+
+    if (s->bass_fft == NULL || s->fft == NULL) {
+        if (s->bass_fft != NULL)
+            cava_fft_destroy(s->bass_fft);
+        if (s->fft != NULL)
+            cava_fft_destroy(s->fft);
+        free(block);
+        pthread_mutex_unlock(&cava_shared_lock);
+        return NULL;
+    }
+
+    s->next = cava_shared_list;
+    cava_shared_list = s;
+    pthread_mutex_unlock(&cava_shared_lock);
+    return s;
+}
+
+// drops a reference to shared resources, destroying them with the last one
+static void shared_release(struct cava_shared *s) {
+    pthread_mutex_lock(&cava_shared_lock);
+    if (--s->refs == 0) {
+        struct cava_shared **link = &cava_shared_list;
+        while (*link != s)
+            link = &(*link)->next;
+        *link = s->next;
+        cava_fft_destroy(s->bass_fft);
+        cava_fft_destroy(s->fft);
+        free(s);
+    }
+    pthread_mutex_unlock(&cava_shared_lock);
+}
+
+// points a plan to shared resources, taking over the caller's reference
+static void plan_attach(struct cava_plan *p, struct cava_shared *s) {
+    p->shared = s;
+    p->bass_fft = s->bass_fft;
+    p->fft = s->fft;
+    p->bass_multiplier = s->bass_multiplier;
+    p->multiplier = s->multiplier;
+    p->half_band_taps = s->half_band_taps;
+}
+
+struct cava_plan *cava_init(int number_of_bars, unsigned int rate, int channels, int autosens,
+                            double noise_reduction, int low_cut_off, int high_cut_off) {
+    struct cava_options options = {
+        .number_of_bars = number_of_bars,
+        .rate = rate,
+        .channels = channels,
+        .autosens = autosens,
+        .noise_reduction = noise_reduction,
+        .low_cut_off = low_cut_off,
+        .high_cut_off = high_cut_off,
+        .history_format = CAVA_HISTORY_DOUBLE,
+        .window = CAVA_WINDOW_HANN,
+        .overlap = 0,
+        .engine = CAVA_ENGINE_FFT,
+        .high_density = 0,
+        .workers = 0,
+    };
+    return cava_init_with_options(&options);
+}
+
+// collects the bins of the bars first to last of an FFT of size samples, if a Goertzel
+// filterbank on just those is cheaper than the FFT, and returns how many there are, or 0 to
+// keep the FFT. a Goertzel filter takes 2 flops per sample and the real FFT about 2 log2(size),
+// so up to log2(size) bins the filterbank takes at most as many, with none of the FFT's
+// shuffling of data. the bars sum the magnitudes of all of their bins, so that is only the case
+// for very few or very narrow bars
+static int select_goertzel(const struct cava_plan *p, int first, int last, int size, int *bins,
+                           double *coeffs) {
+    int max_bins = log2(size);
+    if (max_bins > CAVA_GOERTZEL_MAX_BINS)
+        max_bins = CAVA_GOERTZEL_MAX_BINS;
+
+    int count = 0;
+    for (int n = first; n < last; n++) {
+        for (int i = p->FFTbuffer_lower_cut_off[n]; i <= p->FFTbuffer_upper_cut_off[n]; i++) {
+            // neighbouring bars may share a bin
+            int known = 0;
+            for (int j = 0; j < count; j++)
+                known |= bins[j] == i;
+            if (known)
+                continue;
+            if (count == max_bins)
+                return 0;
+            bins[count++] = i;
+        }
+    }
+
+    for (int j = 0; j < count; j++) {
+        double w = 2 * M_PI * bins[j] / size;
+        coeffs[3 * j] = 2 * cos(w);
+        coeffs[3 * j + 1] = cos(w);
+        coeffs[3 * j + 2] = sin(w);
+    }
+    return count;
+}
+
+// designs the band-pass filters and envelope followers of the filterbank engine for the
+// bars' cut off frequencies, and changes the eq of the FFT to take their envelopes to the
+// same levels
+static void design_biquads(struct cava_plan *p) {
+    double nyquist = p->analysis_rate / 2.0;
+    for (int n = 0; n < p->number_of_bars; n++) {
+        double low = p->cut_off_frequency[n];
+        double high = p->cut_off_frequency[n + 1];
+        if (high > nyquist * 0.95)
+            high = nyquist * 0.95;
+        if (low > high * 0.9)
+            low = high * 0.9;
+        double center = sqrt(low * high);
+        double q = center / (high - low);
+
+        // band-pass with a peak gain of 0 dB, from the audio EQ cookbook. b1 is 0 and b2 is -b0
+        double w0 = 2 * M_PI * center / p->analysis_rate;
+        double alpha = sin(w0) / (2 * q);
+        p->biquad_b0[n] = alpha / (1 + alpha);
+        p->biquad_a1[n] = -2 * cos(w0) / (1 + alpha);
+        p->biquad_a2[n] = (1 - alpha) / (1 + alpha);
+
+        double release = CAVA_BIQUAD_RELEASE_PERIODS / center;
+        if (release < CAVA_BIQUAD_RELEASE_MIN)
+            release = CAVA_BIQUAD_RELEASE_MIN;
+        p->biquad_release[n] = exp(-1 / (release * p->analysis_rate));
+
+        // the eq is made for the FFT the bar would come from. through the Hann window, a sine
+        // comes out of it as a quarter of its amplitude times the size of the FFT in its
+        // nearest bin, and half of that in each neighbour, which the bar adds up. the envelope
+        // is the amplitude itself
+        int size = n < p->bass_cut_off_bar ? p->FFTbassbufferSize : p->FFTbufferSize;
+        p->eq_norm[n] *= size / 2.0;
+    }
+}
+
+// process: calculate cutoff frequencies
+// fills the cut off tables of the bars, pushing them up the spectrum where they would get fewer
+// than a bin each
+static void build_cut_offs(struct cava_plan *p, int low_cut_off, int high_cut_off) {
     int lower_cut_off = low_cut_off;
     int upper_cut_off = high_cut_off;
     int bass_cut_off = 100;
@@ -184,12 +878,16 @@ struct cava_plan *cava_init(int number_of_bars, unsigned int rate, int channels,
     double frequency_constant = log10((float)lower_cut_off / (float)upper_cut_off) /
                                 (1 / ((float)p->number_of_bars + 1) - 1);
 
-    float *relative_cut_off = (float *)malloc((p->number_of_bars + 1) * sizeof(float));
+    float relative_cut_off[p->number_of_bars + 1];
 
     p->bass_cut_off_bar = 0;
     int first_bar = 1;
 
-    float min_bandwidth = p->rate / p->FFTbassbufferSize;
+    // the bass FFT's bins, at the analysis rate
+    int bass_bins = p->FFTbassbufferSize * CAVA_BASS_DECIMATION;
+    double bass_pass_band = CAVA_BASS_PASS_BAND * p->analysis_rate / CAVA_BASS_DECIMATION;
+
+    float min_bandwidth = p->analysis_rate / bass_bins;
 
     for (int n = 0; n < p->number_of_bars + 1; n++) {
         double bar_distribution_coefficient = frequency_constant * (-1);
@@ -203,11 +901,18 @@ struct cava_plan *cava_init(int number_of_bars, unsigned int rate, int channels,
         }
 
         // remember nyquist!
-        relative_cut_off[n] = p->cut_off_frequency[n] / (p->rate / 2);
+        relative_cut_off[n] = p->cut_off_frequency[n] / (p->analysis_rate / 2);
 
-        if (p->cut_off_frequency[n] < bass_cut_off) {
+        // the bass FFT only covers the passband of its decimation, so a bar that would end
+        // above it is taken from the mid and treble FFT even if it starts in the bass
+        double next_bar_distribution_coefficient =
+            frequency_constant * (-1) +
+            ((float)n + 2) / ((float)p->number_of_bars + 1) * frequency_constant;
+        double next_cut_off = upper_cut_off * pow(10, next_bar_distribution_coefficient);
+
+        if (p->cut_off_frequency[n] < bass_cut_off && next_cut_off < bass_pass_band) {
             // BASS
-            p->FFTbuffer_lower_cut_off[n] = relative_cut_off[n] * (p->FFTbassbufferSize / 2);
+            p->FFTbuffer_lower_cut_off[n] = relative_cut_off[n] * (bass_bins / 2);
             p->bass_cut_off_bar++;
             if (p->bass_cut_off_bar > 1)
                 first_bar = 0;
@@ -222,8 +927,7 @@ struct cava_plan *cava_init(int number_of_bars, unsigned int rate, int channels,
             if (n == p->bass_cut_off_bar) {
                 first_bar = 1;
                 if (n > 0) {
-                    p->FFTbuffer_upper_cut_off[n - 1] =
-                        relative_cut_off[n] * (p->FFTbassbufferSize / 2) - 1;
+                    p->FFTbuffer_upper_cut_off[n - 1] = relative_cut_off[n] * (bass_bins / 2) - 1;
                 }
             } else {
                 first_bar = 0;
@@ -266,179 +970,697 @@ struct cava_plan *cava_init(int number_of_bars, unsigned int rate, int channels,
         }
         // calculate actual cut off frequency
         if (n < p->bass_cut_off_bar)
-            relative_cut_off[n] =
-                (float)(p->FFTbuffer_lower_cut_off[n]) / ((float)p->FFTbassbufferSize / 2);
+            relative_cut_off[n] = (float)(p->FFTbuffer_lower_cut_off[n]) / ((float)bass_bins / 2);
         else
             relative_cut_off[n] =
                 (float)(p->FFTbuffer_lower_cut_off[n]) / ((float)p->FFTbufferSize / 2);
 
-        p->cut_off_frequency[n] = relative_cut_off[n] * ((float)p->rate / 2);
+        p->cut_off_frequency[n] = relative_cut_off[n] * ((float)p->analysis_rate / 2);
+    }
+}
+
+// antiderivative of the triangle that interpolates linearly from a bin to its neighbours, at a
+// distance of u bins from it
+static double triangle_integral(double u) {
+    if (u <= -1)
+        return 0;
+    if (u <= 0)
+        return (u + 1) * (u + 1) / 2;
+    if (u <= 1)
+        return 1 - (1 - u) * (1 - u) / 2;
+    return 1;
+}
+
+// fills the cut off tables of high density mode, with the bars spread evenly on a log scale and
+// nothing pushed up, and the weights of the bins of each bar, see cava_plan.dense_weights
+static void build_dense_cut_offs(struct cava_plan *p, int low_cut_off, int high_cut_off) {
+    int bass_cut_off = 100;
+    double bass_pass_band = CAVA_BASS_PASS_BAND * p->analysis_rate / CAVA_BASS_DECIMATION;
+
+    for (int n = 0; n < p->number_of_bars + 1; n++)
+        p->cut_off_frequency[n] = low_cut_off * pow((double)high_cut_off / low_cut_off,
+                                                    (double)n / p->number_of_bars);
+
+    // like build_cut_offs, bars that start in the bass and end in the passband of its
+    // decimation come from the bass FFT
+    p->bass_cut_off_bar = 0;
+    while (p->bass_cut_off_bar < p->number_of_bars &&
+           p->cut_off_frequency[p->bass_cut_off_bar] < bass_cut_off &&
+           p->cut_off_frequency[p->bass_cut_off_bar + 1] < bass_pass_band)
+        p->bass_cut_off_bar++;
+
+    int k = 0;
+    for (int n = 0; n < p->number_of_bars; n++) {
+        int bass = n < p->bass_cut_off_bar;
+        int size = bass ? p->bass_fft_size : p->fft_size;
+        double bin_width = (double)p->analysis_rate / size;
+        if (bass)
+            bin_width /= CAVA_BASS_DECIMATION;
+
+        // the range of the bar in bins
+        double a = p->cut_off_frequency[n] / bin_width;
+        double b = p->cut_off_frequency[n + 1] / bin_width;
+        if (b > size / 2)
+            b = size / 2;
+        if (a > b)
+            a = b;
+        int first = floor(a);
+        int last = ceil(b);
+
+        p->dense_start[n] = k;
+        if (b - a < 1e-9 || first == size / 2) {
+            // too narrow to average over, the interpolated magnitude at the bar
+            last = first + 1 <= size / 2 ? first + 1 : first;
+            p->dense_weights[k++] = 1 - (a - first);
+            if (last > first)
+                p->dense_weights[k++] = a - first;
+        } else {
+            for (int i = first; i <= last; i++)
+                p->dense_weights[k++] =
+                    (triangle_integral(b - i) - triangle_integral(a - i)) / (b - a);
+        }
+        p->FFTbuffer_lower_cut_off[n] = first;
+        p->FFTbuffer_upper_cut_off[n] = last;
     }
+    p->dense_start[p->number_of_bars] = k;
+}
+
+// process: calculate cutoff frequencies and eq
+// fills the cut off tables and the eq of the bars for the plan's number of bars,
+// FFT sizes and rate, and resets the user equalizer to flat
+static void build_bar_tables(struct cava_plan *p, int low_cut_off, int high_cut_off) {
+    if (p->high_density)
+        build_dense_cut_offs(p, low_cut_off, high_cut_off);
+    else
+        build_cut_offs(p, low_cut_off, high_cut_off);
+    int bass_bins = p->FFTbassbufferSize * CAVA_BASS_DECIMATION;
 
     // hard coded eq
     for (int n = 0; n < p->number_of_bars; n++) {
 
         // the numbers that come out of the FFT are very high
         // the EQ is used to "normalize" them by dividing with this very huge number
-        p->eq[n] = 1 / pow(2, 28);
+        p->eq_norm[n] = 1 / pow(2, 28);
 
         // need to boost the EQ for higher frequencies
-        p->eq[n] *= pow(p->cut_off_frequency[n + 1], 0.85);
+        p->eq_norm[n] *= pow(p->cut_off_frequency[n + 1], 0.85);
 
         if (n < p->bass_cut_off_bar) {
-            p->eq[n] /= log2(p->FFTbassbufferSize);
+            // the decimated bass FFT sums up a CAVA_BASS_DECIMATION th of the samples
+            p->eq_norm[n] *= CAVA_BASS_DECIMATION;
+            p->eq_norm[n] /= log2(bass_bins);
         } else {
-            p->eq[n] /= log2(p->FFTbufferSize);
+            p->eq_norm[n] /= log2(p->FFTbufferSize);
         }
 
-        p->eq[n] /= p->FFTbuffer_upper_cut_off[n] - p->FFTbuffer_lower_cut_off[n] + 1;
+        // the weights of the bars of high density mode already take the mean of their bins
+        if (!p->high_density)
+            p->eq_norm[n] /= p->FFTbuffer_upper_cut_off[n] - p->FFTbuffer_lower_cut_off[n] + 1;
+
+        // the eq above was made for the Hann window, the others take the same levels to it
+        if (p->window != CAVA_WINDOW_HANN && p->engine == CAVA_ENGINE_FFT) {
+            if (n < p->bass_cut_off_bar)
+                p->eq_norm[n] *= 0.5 / p->shared->bass_window_gain;
+            else
+                p->eq_norm[n] *= 0.5 / p->shared->window_gain;
+        }
     }
-    free(relative_cut_off);
-    return p;
+    if (p->engine == CAVA_ENGINE_BIQUAD)
+        design_biquads(p);
+    cava_set_equalizer(p, NULL, 0);
+
+    int bass_bars = bass_bar_count(p);
+    // the bins are those of the padded FFTs in high density mode, the padding is 0 so the
+    // filters only run on the windows
+    p->goertzel_bass_count = select_goertzel(p, 0, bass_bars, p->bass_fft_size,
+                                             p->goertzel_bass_bins, p->goertzel_bass_coeffs);
+    p->goertzel_count = select_goertzel(p, p->bass_cut_off_bar, p->number_of_bars, p->fft_size,
+                                        p->goertzel_bins, p->goertzel_coeffs);
+
+    // the bars may have changed, so the next analysis runs both FFTs
+    p->fresh = p->hop;
+    p->bass_fresh = p->bass_hop;
 }
 
-void cava_execute(double *cava_in, int new_samples, double *cava_out, struct cava_plan *p) {
+// sets the hops of a plan for an overlap in percent of the analysis windows
+static void set_overlap(struct cava_plan *p, int overlap) {
+    p->overlap = overlap;
+    if (overlap == 0) {
+        p->hop = 1;
+        p->bass_hop = p->FFTbassbufferSize / CAVA_BASS_HOP_DIVISOR;
+    } else {
+        p->hop = p->FFTbufferSize * (100 - overlap) / 100;
+        p->bass_hop = p->FFTbassbufferSize * (100 - overlap) / 100;
+    }
+}
 
-    // do not overflow
-    if (new_samples > p->input_buffer_size) {
-        new_samples = p->input_buffer_size;
+// starts, stops or restarts the worker pool of a plan for workers and parallel_fft_size, see
+// cava_options, and picks the analysis to match. returns -1 if the threads could not be started
+static int set_workers(struct cava_plan *p, int workers, int parallel_fft_size) {
+    p->workers = workers;
+    p->parallel_fft_size = parallel_fft_size ? parallel_fft_size : CAVA_PARALLEL_FFT_SIZE;
+    int wanted = 0;
+    if (p->engine == CAVA_ENGINE_FFT && p->fft_size >= p->parallel_fft_size)
+        wanted = workers;
+
+    if (p->pool != NULL && p->pool->workers != wanted) {
+        pool_destroy(p->pool);
+        p->pool = NULL;
     }
+    if (p->pool == NULL && wanted > 0)
+        p->pool = pool_create(wanted);
+    select_analyze(p);
+    return p->pool == NULL && wanted > 0 ? -1 : 0;
+}
 
-    int silence = 1;
-    if (new_samples > 0) {
-        p->framerate -= p->framerate / 64;
-        p->framerate += (double)((p->rate * p->audio_channels * p->frame_skip) / new_samples) / 64;
-        p->frame_skip = 1;
-        // shifting input buffer
-        for (uint16_t n = p->input_buffer_size - 1; n >= new_samples; n--) {
-            p->input_buffer[n] = p->input_buffer[n - new_samples];
-        }
+// the channels of the input options analyze, as a mask
+static unsigned int analyzed_mask(const struct cava_options *options) {
+    return options->channel_mask ? options->channel_mask : (1u << options->channels) - 1;
+}
 
-        // fill the input buffer
-        for (uint16_t n = 0; n < new_samples; n++) {
-            p->input_buffer[new_samples - n - 1] = cava_in[n];
-            if (cava_in[n]) {
-                silence = 0;
-            }
-        }
-    } else {
-        p->frame_skip++;
+// allocates the arena of a plan for options and points all of the plan's buffers into it,
+// zeroed. the parameters, shared resources and bar tables are left to the caller.
+// returns NULL if the arena could not be allocated, arena_size is set either way
+static struct cava_plan *plan_alloc(const struct cava_options *options, size_t *arena_size_out) {
+    int number_of_bars = options->number_of_bars;
+    unsigned int channel_mask = analyzed_mask(options);
+    int channels = options->downmix ? 1 : __builtin_popcount(channel_mask);
+    int s16 = options->history_format == CAVA_HISTORY_S16;
+
+    int decimation = decimation_for_rate(options->rate);
+    int fft_buffer_size = fft_buffer_size_for_rate(options->rate / decimation);
+    int fft_bass_buffer_size = fft_buffer_size * 2 / CAVA_BASS_DECIMATION;
+    int bass_fft_size = fft_bass_buffer_size;
+    int fft_size = fft_buffer_size;
+    if (options->high_density) {
+        bass_fft_size *= CAVA_DENSE_BASS_PADDING;
+        fft_size *= CAVA_DENSE_PADDING;
     }
-
-    // fill the bass, mid and treble buffers
-    for (uint16_t n = 0; n < p->FFTbassbufferSize; n++) {
-        if (p->audio_channels == 2) {
-            p->in_bass_r_raw[n] = p->input_buffer[n * 2];
-            p->in_bass_l_raw[n] = p->input_buffer[n * 2 + 1];
-        } else {
-            p->in_bass_l_raw[n] = p->input_buffer[n];
-        }
+    // the history only has to hold the mid and treble FFT's samples, the bass has its own
+    int input_buffer_size = fft_buffer_size * channels;
+    int decimator_taps = CAVA_DECIMATOR_TAPS_PER_PHASE * decimation;
+    // L - 1 frames of history for the filter, a block, and the frames of an incomplete one
+    int decimator_frames = (CAVA_DECIMATOR_TAPS_PER_PHASE + CAVA_DECIMATOR_BLOCK) * decimation;
+    size_t per_bar = (number_of_bars + 1);
+    size_t per_channel_bar = number_of_bars * channels;
+    // the outputs of the channels' FFTs start on cache lines, 4 bins each
+    int bass_out_stride = (bass_fft_size / 2 + 4) & ~3;
+    int out_stride = (fft_size / 2 + 4) & ~3;
+
+    // arena layout: the per bar tables, then the smoothing state of all bars as one
+    // block of adjacent arrays, then the sample buffers and FFT buffers
+    size_t arena_size = 0;
+    arena_reserve(&arena_size, sizeof(struct cava_plan));
+    size_t eq_at = arena_reserve(&arena_size, per_bar * sizeof(double));
+    size_t eq_norm_at = arena_reserve(&arena_size, per_bar * sizeof(double));
+    size_t cut_off_frequency_at = arena_reserve(&arena_size, per_bar * sizeof(float));
+    size_t lower_cut_off_at = arena_reserve(&arena_size, per_bar * sizeof(int));
+    size_t upper_cut_off_at = arena_reserve(&arena_size, per_bar * sizeof(int));
+    size_t cava_fall_at = arena_reserve(&arena_size, per_channel_bar * sizeof(double));
+    size_t cava_mem_at = arena_reserve(&arena_size, per_channel_bar * sizeof(double));
+    size_t cava_peak_at = arena_reserve(&arena_size, per_channel_bar * sizeof(double));
+    size_t prev_cava_out_at = arena_reserve(&arena_size, per_channel_bar * sizeof(double));
+    size_t cava_bands_at = arena_reserve(&arena_size, per_channel_bar * sizeof(double));
+    size_t biquad_coeffs_at = arena_reserve(&arena_size, 4 * number_of_bars * sizeof(double));
+    size_t biquad_state_at = arena_reserve(&arena_size, 3 * per_channel_bar * sizeof(double));
+    size_t dense_start_at = 0, dense_weights_at = 0;
+    if (options->high_density) {
+        // a bar takes at most 3 bins more than the width of its range, and the ranges of the
+        // bars of each FFT add up to at most its bins
+        size_t weights = 3 * number_of_bars + bass_fft_size / 2 + fft_size / 2 + 2;
+        dense_start_at = arena_reserve(&arena_size, per_bar * sizeof(int));
+        dense_weights_at = arena_reserve(&arena_size, weights * sizeof(double));
     }
-    for (uint16_t n = 0; n < p->FFTbufferSize; n++) {
-        if (p->audio_channels == 2) {
-            p->in_r_raw[n] = p->input_buffer[n * 2];
-            p->in_l_raw[n] = p->input_buffer[n * 2 + 1];
-        } else {
-            p->in_l_raw[n] = p->input_buffer[n];
-        }
+    size_t history_at;
+    if (s16)
+        history_at = arena_reserve(&arena_size, input_buffer_size * sizeof(int16_t));
+    else
+        history_at = arena_reserve(&arena_size, input_buffer_size * sizeof(double));
+    size_t bass_history_at =
+        arena_reserve(&arena_size, fft_bass_buffer_size * channels * sizeof(double));
+    size_t goertzel_bins_at = arena_reserve(&arena_size, 2 * CAVA_GOERTZEL_MAX_BINS * sizeof(int));
+    size_t goertzel_coeffs_at =
+        arena_reserve(&arena_size, 2 * 3 * CAVA_GOERTZEL_MAX_BINS * sizeof(double));
+    size_t half_band_in_at = arena_reserve(
+        &arena_size, channels * CAVA_HALF_BAND_STAGES * 2 * CAVA_HALF_BAND_TAPS * sizeof(double));
+    size_t in_bass_at = arena_reserve(&arena_size, bass_fft_size * channels * sizeof(double));
+    size_t in_at = arena_reserve(&arena_size, fft_size * channels * sizeof(double));
+    size_t out_bass_at =
+        arena_reserve(&arena_size, bass_out_stride * channels * sizeof(cava_complex));
+    size_t out_at = arena_reserve(&arena_size, out_stride * channels * sizeof(cava_complex));
+    size_t decimator_taps_at = 0, decimator_in_at = 0, decimator_out_at = 0;
+    if (decimation > 1) {
+        decimator_taps_at = arena_reserve(&arena_size, decimator_taps * sizeof(double));
+        decimator_in_at =
+            arena_reserve(&arena_size, (size_t)decimator_frames * channels * sizeof(double));
+        decimator_out_at =
+            arena_reserve(&arena_size, CAVA_DECIMATOR_BLOCK * channels * sizeof(double));
     }
+    size_t job_time_at =
+        arena_reserve(&arena_size, 2 * channels * CAVA_STAGE_SMOOTHING * sizeof(double));
+    // fewer channels than the input has are only analyzed after picking them out or mixing them
+    size_t select_buffer_at = 0;
+    if (channels != options->channels)
+        select_buffer_at =
+            arena_reserve(&arena_size, CAVA_SELECT_BLOCK * channels * sizeof(double));
+
+    *arena_size_out = arena_size;
+    char *arena = NULL;
+    if (posix_memalign((void **)&arena, CAVA_ARENA_ALIGNMENT, arena_size) != 0)
+        return NULL;
+    memset(arena, 0, arena_size);
+    struct cava_plan *p = (struct cava_plan *)arena;
 
-    // Hann Window
-    for (int i = 0; i < p->FFTbassbufferSize; i++) {
-        p->in_bass_l[i] = p->bass_multiplier[i] * p->in_bass_l_raw[i];
-        if (p->audio_channels == 2)
-            p->in_bass_r[i] = p->bass_multiplier[i] * p->in_bass_r_raw[i];
+    p->number_of_bars = number_of_bars;
+    p->audio_channels = channels;
+    p->input_channels = options->channels;
+    p->channel_mask = channel_mask;
+    p->downmix = options->downmix != 0;
+    p->rate = options->rate;
+    p->decimation = decimation;
+    p->analysis_rate = options->rate / decimation;
+    p->FFTbassbufferSize = fft_bass_buffer_size;
+    p->FFTbufferSize = fft_buffer_size;
+    p->bass_fft_size = bass_fft_size;
+    p->fft_size = fft_size;
+    p->high_density = options->high_density;
+    p->window = options->window;
+    p->engine = options->engine;
+    p->input_buffer_size = input_buffer_size;
+
+    if (s16)
+        p->history_s16 = (int16_t *)(arena + history_at);
+    else
+        p->input_buffer = (double *)(arena + history_at);
+    select_analyze(p);
+    p->bass_history = (double *)(arena + bass_history_at);
+    p->half_band_in = (double *)(arena + half_band_in_at);
+    p->goertzel_bass_bins = (int *)(arena + goertzel_bins_at);
+    p->goertzel_bins = p->goertzel_bass_bins + CAVA_GOERTZEL_MAX_BINS;
+    p->goertzel_bass_coeffs = (double *)(arena + goertzel_coeffs_at);
+    p->goertzel_coeffs = p->goertzel_bass_coeffs + 3 * CAVA_GOERTZEL_MAX_BINS;
+
+    p->FFTbuffer_lower_cut_off = (int *)(arena + lower_cut_off_at);
+    p->FFTbuffer_upper_cut_off = (int *)(arena + upper_cut_off_at);
+    p->eq = (double *)(arena + eq_at);
+    p->eq_norm = (double *)(arena + eq_norm_at);
+    p->cut_off_frequency = (float *)(arena + cut_off_frequency_at);
+
+    p->cava_fall = (double *)(arena + cava_fall_at);
+    p->cava_mem = (double *)(arena + cava_mem_at);
+    p->cava_peak = (double *)(arena + cava_peak_at);
+    p->prev_cava_out = (double *)(arena + prev_cava_out_at);
+    p->cava_bands = (double *)(arena + cava_bands_at);
+    p->biquad_b0 = (double *)(arena + biquad_coeffs_at);
+    p->biquad_a1 = p->biquad_b0 + number_of_bars;
+    p->biquad_a2 = p->biquad_a1 + number_of_bars;
+    p->biquad_release = p->biquad_a2 + number_of_bars;
+    p->biquad_z1 = (double *)(arena + biquad_state_at);
+    p->biquad_z2 = p->biquad_z1 + per_channel_bar;
+    p->biquad_env = p->biquad_z2 + per_channel_bar;
+    if (options->high_density) {
+        p->dense_start = (int *)(arena + dense_start_at);
+        p->dense_weights = (double *)(arena + dense_weights_at);
     }
-    for (int i = 0; i < p->FFTbufferSize; i++) {
-        p->in_l[i] = p->multiplier[i] * p->in_l_raw[i];
-        if (p->audio_channels == 2)
-            p->in_r[i] = p->multiplier[i] * p->in_r_raw[i];
+
+    p->in_bass = (double *)(arena + in_bass_at);
+    p->in = (double *)(arena + in_at);
+    p->out_bass = (cava_complex *)(arena + out_bass_at);
+    p->out = (cava_complex *)(arena + out_at);
+    p->bass_out_stride = bass_out_stride;
+    p->out_stride = out_stride;
+    if (decimation > 1) {
+        p->decimator_taps = (double *)(arena + decimator_taps_at);
+        p->decimator_in = (double *)(arena + decimator_in_at);
+        p->decimator_out = (double *)(arena + decimator_out_at);
     }
+    if (channels != options->channels)
+        p->select_buffer = (double *)(arena + select_buffer_at);
+    p->job_time = (double *)(arena + job_time_at);
+    return p;
+}
 
-    // process: execute FFT and sort frequency bands
+// designs the anti-alias filter of the decimator, see CAVA_DECIMATOR_TAPS_PER_PHASE. tap k is
+// stored at (k % decimation) * CAVA_DECIMATOR_TAPS_PER_PHASE + k / decimation, so that the
+// taps of each phase are adjacent
+static void design_decimator(struct cava_plan *p) {
+    int d = p->decimation;
+    int taps = CAVA_DECIMATOR_TAPS_PER_PHASE * d;
+    double beta = 0.1102 * (CAVA_DECIMATOR_ATTENUATION - 8.7);
+    double cut_off = 0.5 / d; // cycles per input sample
+    double center = (taps - 1) / 2.0;
+    double sum = 0;
+    for (int k = 0; k < taps; k++) {
+        double t = k - center;
+        double sinc = t == 0 ? 1 : sin(2 * M_PI * cut_off * t) / (2 * M_PI * cut_off * t);
+        double r = t / center;
+        double window = bessel_i0(beta * sqrt(1 - r * r)) / bessel_i0(beta);
+        double tap = 2 * cut_off * sinc * window;
+        p->decimator_taps[(k % d) * CAVA_DECIMATOR_TAPS_PER_PHASE + k / d] = tap;
+        sum += tap;
+    }
+    // unity gain at DC
+    for (int k = 0; k < taps; k++)
+        p->decimator_taps[k] /= sum;
+}
 
-    fftw_execute(p->p_bass_l);
-    fftw_execute(p->p_l);
-    if (p->audio_channels == 2) {
-        fftw_execute(p->p_bass_r);
-        fftw_execute(p->p_r);
+struct cava_plan *cava_init_with_options(const struct cava_options *options) {
+    char error_message[1024];
+    if (validate_parameters(error_message, options->number_of_bars, options->rate,
+                            options->channels, options->channel_mask, options->low_cut_off,
+                            options->high_cut_off, options->window, options->overlap,
+                            options->engine, options->high_density, options->workers,
+                            options->parallel_fft_size) != 0) {
+        struct cava_plan *p = calloc(1, sizeof(struct cava_plan));
+        memcpy(p->error_message, error_message, sizeof(error_message));
+        p->status = -1;
+        return p;
     }
 
-    // process: separate frequency bands
-    for (int n = 0; n < p->number_of_bars; n++) {
+    size_t arena_size;
+    struct cava_plan *p = plan_alloc(options, &arena_size);
+    if (p == NULL) {
+        p = calloc(1, sizeof(struct cava_plan));
+        snprintf(p->error_message, 1024, "cava_init could not allocate %zu bytes\n", arena_size);
+        p->status = -1;
+        return p;
+    }
 
-        double temp_l = 0;
-        double temp_r = 0;
+    struct cava_shared *shared = shared_acquire(p, options->window);
+    if (shared == NULL) {
+        free(p);
+        p = calloc(1, sizeof(struct cava_plan));
+        snprintf(p->error_message, 1024, "cava_init could not allocate the FFT plans\n");
+        p->status = -1;
+        return p;
+    }
+    plan_attach(p, shared);
+    if (set_workers(p, options->workers, options->parallel_fft_size) != 0) {
+        shared_release(shared);
+        free(p);
+        p = calloc(1, sizeof(struct cava_plan));
+        snprintf(p->error_message, 1024, "cava_init could not start the FFT workers\n");
+        p->status = -1;
+        return p;
+    }
+    p->status = 0;
 
-        // process: add upp FFT values within bands
-        for (int i = p->FFTbuffer_lower_cut_off[n]; i <= p->FFTbuffer_upper_cut_off[n]; i++) {
+    p->autosens = 1;
+    p->sens_init = 1;
+    p->sens = 1.0;
+    p->autosens = options->autosens;
+    p->framerate = 75;
+    p->frame_skip = 1;
+    p->pending_silence = 1;
+    p->noise_reduction = options->noise_reduction;
+    p->timing = options->timing;
+    if (p->decimation > 1)
+        design_decimator(p);
+
+    set_overlap(p, options->overlap);
+    build_bar_tables(p, options->low_cut_off, options->high_cut_off);
+    return p;
+}
 
-            if (n < p->bass_cut_off_bar) {
-                temp_l += hypot(p->out_bass_l[i][0], p->out_bass_l[i][1]);
-                if (p->audio_channels == 2)
-                    temp_r += hypot(p->out_bass_r[i][0], p->out_bass_r[i][1]);
+struct cava_plan *cava_reconfigure(struct cava_plan *p, const struct cava_options *options) {
+    char error_message[1024];
+    int s16 = options->history_format == CAVA_HISTORY_S16;
+
+    // a new rate means new FFT sizes, so new FFT plans and history, and so does a change
+    // of the channels, of the ones analyzed or of the history format. cava_init also reports
+    // illegal options
+    if (p->status != 0 ||
+        validate_parameters(error_message, options->number_of_bars, options->rate,
+                            options->channels, options->channel_mask, options->low_cut_off,
+                            options->high_cut_off, options->window, options->overlap,
+                            options->engine, options->high_density, options->workers,
+                            options->parallel_fft_size) != 0 ||
+        options->rate != (unsigned int)p->rate || options->channels != p->input_channels ||
+        analyzed_mask(options) != p->channel_mask || (options->downmix != 0) != p->downmix ||
+        s16 != (p->history_s16 != NULL)) {
+        cava_destroy(p);
+        return cava_init_with_options(options);
+    }
 
-            } else {
-                temp_l += hypot(p->out_l[i][0], p->out_l[i][1]);
-                if (p->audio_channels == 2)
-                    temp_r += hypot(p->out_r[i][0], p->out_r[i][1]);
-            }
+    if (options->number_of_bars != p->number_of_bars ||
+        options->high_density != p->high_density) {
+        // the per bar arrays change size, and so do the FFT buffers in and out of high density
+        // mode, so the plan moves to a new arena. the shared resources and history move along,
+        // the smoothing state of the bars starts over unless there are as many as before
+        size_t arena_size;
+        struct cava_plan *q = plan_alloc(options, &arena_size);
+        if (q == NULL) {
+            cava_destroy(p);
+            return cava_init_with_options(options);
         }
+        q->status = 0;
+        q->autosens = p->autosens;
+        q->noise_reduction = p->noise_reduction;
+        plan_attach(q, p->shared);
+        q->pool = p->pool;
+        if (q->decimation > 1)
+            memcpy(q->decimator_taps, p->decimator_taps,
+                   CAVA_DECIMATOR_TAPS_PER_PHASE * p->decimation * sizeof(double));
+        cava_inherit(q, p);
+
+        // the old plan's reference to the shared resources and its workers now belong to q, so
+        // only its arena is freed
+        free(p);
+        p = q;
+    }
 
-        // getting average multiply with eq
-        temp_l *= p->eq[n];
-        cava_out[n] = temp_l;
-
-        if (p->audio_channels == 2) {
-            temp_r *= p->eq[n];
-            cava_out[n + p->number_of_bars] = temp_r;
+    // a plan moved to a new arena above already has the new window and FFT sizes, but still
+    // the shared resources of the old ones
+    if (options->window != p->shared->window || p->shared->bass_fft_size != p->bass_fft_size ||
+        p->shared->fft_size != p->fft_size) {
+        // the FFT plans of the new window are the same as the old ones, unless no other plan
+        // uses that window yet. plans in and out of high density mode need other FFT sizes
+        struct cava_shared *shared = shared_acquire(p, options->window);
+        if (shared == NULL) {
+            cava_destroy(p);
+            return cava_init_with_options(options);
         }
+        shared_release(p->shared);
+        plan_attach(p, shared);
+        p->window = options->window;
     }
 
-    // applying sens or getting max value
-    if (p->autosens) {
-        for (int n = 0; n < p->number_of_bars * p->audio_channels; n++) {
-            cava_out[n] *= p->sens;
-        }
+    if (options->engine != p->engine) {
+        // the filters start from silence, the FFTs from the history they kept on writing.
+        // the filterbank does not feed the bass history, which fills up again within the
+        // length of its window
+        p->engine = options->engine;
+        size_t size = p->number_of_bars * p->audio_channels * sizeof(double);
+        memset(p->biquad_z1, 0, size);
+        memset(p->biquad_z2, 0, size);
+        memset(p->biquad_env, 0, size);
     }
-    // process [smoothing]
-    int overshoot = 0;
-    double gravity_mod = pow((60 / p->framerate), 2.5) * 1.54 / p->noise_reduction;
 
-    if (gravity_mod < 1)
-        gravity_mod = 1;
+    // the workers only run for the FFT engine and large enough FFTs, this also picks the
+    // analysis for a new engine
+    if (set_workers(p, options->workers, options->parallel_fft_size) != 0) {
+        cava_destroy(p);
+        return cava_init_with_options(options);
+    }
 
-    for (int n = 0; n < p->number_of_bars * p->audio_channels; n++) {
+    p->autosens = options->autosens;
+    p->timing = options->timing;
+    memset(p->stage_time, 0, sizeof(p->stage_time));
+    if (options->noise_reduction != p->noise_reduction) {
+        p->noise_reduction = options->noise_reduction;
+        // forces gravity_mod to be recomputed
+        p->gravity_framerate = 0;
+    }
 
-        // process [smoothing]: falloff
+    set_overlap(p, options->overlap);
+    build_bar_tables(p, options->low_cut_off, options->high_cut_off);
+    return p;
+}
+
+void cava_inherit(struct cava_plan *p, const struct cava_plan *from) {
+    int s16 = p->history_s16 != NULL;
+    if (p->status != 0 || from->status != 0 || p->rate != from->rate ||
+        p->input_channels != from->input_channels || p->channel_mask != from->channel_mask ||
+        p->downmix != from->downmix || s16 != (from->history_s16 != NULL))
+        return;
+
+    p->sens_init = from->sens_init;
+    p->sens = from->sens;
+    p->framerate = from->framerate;
+    p->frame_skip = from->frame_skip;
+    if (p->noise_reduction == from->noise_reduction) {
+        p->gravity_mod = from->gravity_mod;
+        p->gravity_framerate = from->gravity_framerate;
+    }
+    p->history_pos = from->history_pos;
+    p->pending_samples = from->pending_samples;
+    p->pending_silence = from->pending_silence;
+    if (s16)
+        memcpy(p->history_s16, from->history_s16, p->input_buffer_size * sizeof(int16_t));
+    else
+        memcpy(p->input_buffer, from->input_buffer, p->input_buffer_size * sizeof(double));
+    p->bass_pos = from->bass_pos;
+    p->bass_count = from->bass_count;
+    memcpy(p->half_band_pos, from->half_band_pos, sizeof(p->half_band_pos));
+    memcpy(p->bass_history, from->bass_history,
+           p->FFTbassbufferSize * p->audio_channels * sizeof(double));
+    memcpy(p->half_band_in, from->half_band_in,
+           p->audio_channels * CAVA_HALF_BAND_STAGES * 2 * CAVA_HALF_BAND_TAPS * sizeof(double));
+    if (p->decimation > 1) {
+        p->decimator_pos = from->decimator_pos;
+        memcpy(p->decimator_in, from->decimator_in,
+               (size_t)(CAVA_DECIMATOR_TAPS_PER_PHASE + CAVA_DECIMATOR_BLOCK) * p->decimation *
+                   p->audio_channels * sizeof(double));
+    }
 
-        if (cava_out[n] < p->prev_cava_out[n] && p->noise_reduction > 0.1) {
-            cava_out[n] =
-                p->cava_peak[n] * (1.0 - (p->cava_fall[n] * p->cava_fall[n] * gravity_mod));
+    // the smoothing state is per bar, so it only carries over to the same bars
+    if (p->number_of_bars == from->number_of_bars) {
+        size_t size = p->number_of_bars * p->audio_channels * sizeof(double);
+        memcpy(p->cava_fall, from->cava_fall, size);
+        memcpy(p->cava_mem, from->cava_mem, size);
+        memcpy(p->cava_peak, from->cava_peak, size);
+        memcpy(p->prev_cava_out, from->prev_cava_out, size);
+    }
 
-            if (cava_out[n] < 0.0)
-                cava_out[n] = 0.0;
-            p->cava_fall[n] += 0.028;
-        } else {
-            p->cava_peak[n] = cava_out[n];
-            p->cava_fall[n] = 0.0;
-        }
-        p->prev_cava_out[n] = cava_out[n];
+    // so do the magnitudes of the bars, which are not recomputed on every execution, as long
+    // as they come from the same bins through the same window
+    int same_bars = p->number_of_bars == from->number_of_bars &&
+                    p->bass_cut_off_bar == from->bass_cut_off_bar && p->window == from->window &&
+                    p->engine == from->engine && p->high_density == from->high_density;
+    for (int n = 0; same_bars && n < p->number_of_bars; n++)
+        same_bars = p->FFTbuffer_lower_cut_off[n] == from->FFTbuffer_lower_cut_off[n] &&
+                    p->FFTbuffer_upper_cut_off[n] == from->FFTbuffer_upper_cut_off[n];
+    if (same_bars) {
+        memcpy(p->cava_bands, from->cava_bands,
+               p->number_of_bars * p->audio_channels * sizeof(double));
+        p->fresh = from->fresh;
+        p->bass_fresh = from->bass_fresh;
+        // the filter states and envelopes are one block
+        memcpy(p->biquad_z1, from->biquad_z1,
+               3 * p->number_of_bars * p->audio_channels * sizeof(double));
+    }
+}
+
+void cava_set_equalizer(struct cava_plan *p, const double *gains, int key_count) {
+    if (gains == NULL || key_count < 1) {
+        memcpy(p->eq, p->eq_norm, p->number_of_bars * sizeof(double));
+        return;
+    }
+    for (int n = 0; n < p->number_of_bars; n++) {
+        // position of the bar on the key scale, keys sit in the middle of the
+        // bar range they used to cover
+        double key = ((double)n + 0.5) * key_count / p->number_of_bars - 0.5;
+        if (key < 0)
+            key = 0;
+        if (key > key_count - 1)
+            key = key_count - 1;
+        int lower = (int)key;
+        int upper = lower + 1 < key_count ? lower + 1 : lower;
+        double fraction = key - lower;
+        double gain = gains[lower] * (1.0 - fraction) + gains[upper] * fraction;
+        p->eq[n] = p->eq_norm[n] * gain;
+    }
+}
+
+// runs the eq, sens, falloff and integral stages on the bars of one channel, the arrays
+// are that channel's slice of the per bar state. there are no branches in the loop so that
+// it vectorizes across bars: which bars are falling is a mask of 0.0 and 1.0, and the two
+// outcomes are blended with it, which is exact since all of the values are finite
+static void smooth_bars(const struct cava_plan *p, const double *restrict cava_bands,
+                        const double *restrict eq, double *restrict cava_fall,
+                        double *restrict cava_peak, double *restrict cava_mem,
+                        double *restrict prev_cava_out, double *restrict cava_out) {
+    // without autosens the bars are multiplied by 1.0 and compared against infinity,
+    // which leaves them untouched
+    const double sens = p->autosens ? p->sens : 1.0;
+    const double limit = p->autosens ? 1.0 : INFINITY;
+    const double falloff = p->noise_reduction > 0.1 ? 1.0 : 0.0;
+    const double noise_reduction = p->noise_reduction;
+    // the mask below only blends finite values exactly, and without falloff gravity_mod can be
+    // infinite, a noise_reduction of 0 divides by 0. it is not used then, so 0 stands in for it
+    const double gravity_mod = falloff ? p->gravity_mod : 0.0;
+
+    const int number_of_bars = p->number_of_bars;
+    for (int n = 0; n < number_of_bars; n++) {
+        // getting average multiply with eq, applying sens
+        double out = cava_bands[n] * eq[n] * sens;
+        double peak = cava_peak[n];
+        double fall = cava_fall[n];
+
+        // process [smoothing]: falloff
+        double falling = out < prev_cava_out[n] ? falloff : 0.0;
+        double fallen = peak * (1.0 - (fall * fall * gravity_mod));
+        fallen = fallen < 0.0 ? 0.0 : fallen;
+        cava_peak[n] = falling * peak + (1.0 - falling) * out;
+        cava_fall[n] = falling * (fall + 0.028);
+        out = falling * fallen + (1.0 - falling) * out;
+        prev_cava_out[n] = out;
 
         // process [smoothing]: integral
-        cava_out[n] = p->cava_mem[n] * p->noise_reduction + cava_out[n];
-        p->cava_mem[n] = cava_out[n];
-        if (p->autosens) {
-            // check if we overshoot target height
-            if (cava_out[n] > 1.0) {
-                overshoot = 1;
-                cava_out[n] = 1.0;
-            }
+        out = cava_mem[n] * noise_reduction + out;
+        cava_mem[n] = out;
+
+        // clamping to the target height, cava_mem keeps whether a bar overshot it
+        cava_out[n] = out > limit ? limit : out;
+    }
+}
+
+// everything after the new samples are in the history: analysis, smoothing and autosens
+static void process(struct cava_plan *p, int new_samples, int silence, double *cava_out) {
+    if (new_samples > 0) {
+        p->framerate -= p->framerate / 64;
+        p->framerate +=
+            (double)((p->analysis_rate * p->audio_channels * p->frame_skip) / new_samples) / 64;
+        p->frame_skip = 1;
+
+        // without new samples the spectrum is the same as last time, so only
+        // the smoothing below needs to run again
+        if (p->timing)
+            memset(p->job_time, 0, 2 * p->audio_channels * CAVA_STAGE_SMOOTHING * sizeof(double));
+        p->analyze(p);
+    } else {
+        p->frame_skip++;
+    }
+
+    double smoothing_start = 0;
+    if (p->timing) {
+        // the FFTs that did not run left their slots at 0
+        memset(p->stage_time, 0, sizeof(p->stage_time));
+        for (int job = 0; new_samples > 0 && job < 2 * p->audio_channels; job++) {
+            for (int stage = 0; stage < CAVA_STAGE_SMOOTHING; stage++)
+                p->stage_time[stage] += p->job_time[job * CAVA_STAGE_SMOOTHING + stage];
         }
+        smoothing_start = clock_seconds();
     }
 
+    // process [smoothing]
+    // gravity_mod is only recomputed once the framerate estimate has moved by more than
+    // CAVA_GRAVITY_FRAMERATE_TOLERANCE, see there for how far off that lets it get
+    if (fabs(p->framerate - p->gravity_framerate) >
+        p->gravity_framerate * CAVA_GRAVITY_FRAMERATE_TOLERANCE) {
+        p->gravity_mod = pow((60 / p->framerate), 2.5) * 1.54 / p->noise_reduction;
+
+        if (p->gravity_mod < 1)
+            p->gravity_mod = 1;
+        p->gravity_framerate = p->framerate;
+    }
+
+    for (int c = 0; c < p->audio_channels; c++) {
+        int offset = c * p->number_of_bars;
+        smooth_bars(p, p->cava_bands + offset, p->eq, p->cava_fall + offset,
+                    p->cava_peak + offset, p->cava_mem + offset, p->prev_cava_out + offset,
+                    cava_out + offset);
+    }
     // calculating automatic sense adjustment
     if (p->autosens) {
+        // check if we overshoot target height
+        int overshoot = 0;
+        for (int n = 0; n < p->number_of_bars * p->audio_channels; n++) {
+            if (p->cava_mem[n] > 1.0) {
+                overshoot = 1;
+                break;
+            }
+        }
         if (overshoot) {
             p->sens = p->sens * 0.98;
             p->sens_init = 0;
@@ -450,43 +1672,290 @@ void cava_execute(double *cava_in, int new_samples, double *cava_out, struct cav
             }
         }
     }
+
+    if (p->timing)
+        p->stage_time[CAVA_STAGE_SMOOTHING] = clock_seconds() - smoothing_start;
 }
 
-void cava_destroy(struct cava_plan *p) {
+// converts a sample to the range of the s16 history, rounding and saturating
+static inline int16_t sample_to_s16(double sample) {
+    if (sample >= INT16_MAX)
+        return INT16_MAX;
+    if (sample <= INT16_MIN)
+        return INT16_MIN;
+    return (int16_t)lrint(sample);
+}
+
+// feeds a sample of channel c at the analysis rate to the half-band cascade of the bass. a
+// stage puts out every second sample it takes in, which the next stage takes in, so that the
+// last one puts one in the bass history every CAVA_BASS_DECIMATION samples. the delay lines
+// hold every sample twice, so that the newest CAVA_HALF_BAND_TAPS are always in one piece
+static inline __attribute__((always_inline)) void push_bass(struct cava_plan *p, int c,
+                                                            double sample) {
+    const double *taps = p->half_band_taps;
+    const int center = (CAVA_HALF_BAND_TAPS - 1) / 2;
+    for (int stage = 0; stage < CAVA_HALF_BAND_STAGES; stage++) {
+        double *line =
+            p->half_band_in + (c * CAVA_HALF_BAND_STAGES + stage) * 2 * CAVA_HALF_BAND_TAPS;
+        int pos = p->half_band_pos[stage];
+        line[pos] = line[pos + CAVA_HALF_BAND_TAPS] = sample;
+        if (!(p->bass_count >> stage & 1))
+            return;
+        const double *window = line + pos + 1 + center;
+        sample = taps[0] * window[0];
+        for (int i = 0; i < CAVA_HALF_BAND_PAIRS; i++)
+            sample += taps[i + 1] * (window[-2 * i - 1] + window[2 * i + 1]);
+    }
+    p->bass_history[c * p->FFTbassbufferSize + p->bass_pos] = sample;
+}
+
+// moves the half-band cascade on by one frame, once push_bass has been called for each channel
+static void advance_bass(struct cava_plan *p) {
+    for (int stage = 0; stage < CAVA_HALF_BAND_STAGES; stage++) {
+        // the stages up to here put out a sample, so this one took one in
+        int mask = (1 << stage) - 1;
+        if ((p->bass_count & mask) == mask)
+            p->half_band_pos[stage] = (p->half_band_pos[stage] + 1) % CAVA_HALF_BAND_TAPS;
+    }
+    if (p->bass_count == CAVA_BASS_DECIMATION - 1) {
+        p->bass_pos = (p->bass_pos + 1) & (p->FFTbassbufferSize - 1);
+        if (p->bass_fresh < 2 * p->bass_hop)
+            p->bass_fresh++;
+    }
+    p->bass_count = (p->bass_count + 1) & (CAVA_BASS_DECIMATION - 1);
+}
+
+// appends frames at the analysis rate to the history and counts them as pending for the next
+// execution
+static inline __attribute__((always_inline)) void
+store_frames(struct cava_plan *p, const void *data, const enum sample_type type, int frames,
+             ptrdiff_t frame_stride, ptrdiff_t channel_stride) {
+    const int channels = p->audio_channels;
+
+    // the bass history spans more time than the other one, and the filters need every frame.
+    // the filterbank takes the place of both FFTs, it runs on the history, see analyze_biquad
+    if (p->engine == CAVA_ENGINE_FFT) {
+        for (ptrdiff_t f = 0; f < frames; f++) {
+            for (int c = 0; c < channels; c++)
+                push_bass(p, c, read_sample(data, type, f * frame_stride + c * channel_stride));
+            advance_bass(p);
+        }
+    }
+
+    // counted before the history cuts them off, so that the analyses keep to their hop
+    if (frames > 0)
+        p->fresh = p->fresh + frames < 2 * p->hop ? p->fresh + frames : 2 * p->hop;
+
+    // only the newest frames fit in the history
+    ptrdiff_t first = 0;
+    if (frames > p->input_buffer_size / channels) {
+        first = frames - p->input_buffer_size / channels;
+        frames = p->input_buffer_size / channels;
+    }
+    if (frames < 1)
+        return;
+
+    // either history is one ring per channel, written at the same position
+    int silence = 1;
+    if (p->history_s16) {
+        for (ptrdiff_t f = first; f < first + frames; f++) {
+            for (int c = 0; c < channels; c++) {
+                ptrdiff_t i = f * frame_stride + c * channel_stride;
+                int16_t sample = type == SAMPLE_S16 ? ((const int16_t *)data)[i]
+                                                    : sample_to_s16(read_sample(data, type, i));
+                p->history_s16[c * p->FFTbufferSize + p->history_pos] = sample;
+                if (sample)
+                    silence = 0;
+            }
+            p->history_pos = (p->history_pos + 1) & (p->FFTbufferSize - 1);
+        }
+    } else {
+        for (ptrdiff_t f = first; f < first + frames; f++) {
+            for (int c = 0; c < channels; c++) {
+                double sample = read_sample(data, type, f * frame_stride + c * channel_stride);
+                p->input_buffer[c * p->FFTbufferSize + p->history_pos] = sample;
+                if (sample)
+                    silence = 0;
+            }
+            p->history_pos = (p->history_pos + 1) & (p->FFTbufferSize - 1);
+        }
+    }
+
+    p->pending_samples += frames * channels;
+    if (p->pending_samples > p->input_buffer_size)
+        p->pending_samples = p->input_buffer_size;
+    if (!silence)
+        p->pending_silence = 0;
+}
+
+// filters the complete groups of decimation frames in the decimator and stores one output
+// frame for each. the input of each channel is kept as one array per phase, a group's frames
+// being one sample of each, so that every tap is applied to all outputs in one loop that
+// vectorizes, rather than in a dot product per output
+static void decimator_flush(struct cava_plan *p) {
+    const int d = p->decimation;
+    const int taps = CAVA_DECIMATOR_TAPS_PER_PHASE;
+    const int length = CAVA_DECIMATOR_TAPS_PER_PHASE + CAVA_DECIMATOR_BLOCK;
+    int groups = p->decimator_pos / d;
+    if (groups == 0)
+        return;
+
+    for (int c = 0; c < p->audio_channels; c++) {
+        double *restrict out = p->decimator_out + c * CAVA_DECIMATOR_BLOCK;
+        memset(out, 0, groups * sizeof(double));
+        // tap l * d + s applies to phase d - 1 - s of the group l before
+        for (int s = 0; s < d; s++) {
+            const double *in = p->decimator_in + (c * d + d - 1 - s) * length;
+            const double *h = p->decimator_taps + s * taps;
+            for (int l = 0; l < taps; l++) {
+                const double tap = h[l];
+                const double *restrict x = in + taps - 1 - l;
+                for (int j = 0; j < groups; j++)
+                    out[j] += tap * x[j];
+            }
+        }
+    }
+    store_frames(p, p->decimator_out, SAMPLE_DOUBLE, groups, 1, CAVA_DECIMATOR_BLOCK);
 
-    free(p->input_buffer);
-    free(p->bass_multiplier);
-    free(p->multiplier);
-    free(p->eq);
-    free(p->cut_off_frequency);
-    free(p->FFTbuffer_lower_cut_off);
-    free(p->FFTbuffer_upper_cut_off);
-    free(p->cava_fall);
-    free(p->cava_mem);
-    free(p->cava_peak);
-    free(p->prev_cava_out);
-
-    fftw_free(p->in_bass_l);
-    fftw_free(p->in_bass_l_raw);
-    fftw_free(p->out_bass_l);
-    fftw_destroy_plan(p->p_bass_l);
-
-    fftw_free(p->in_l);
-    fftw_free(p->in_l_raw);
-    fftw_free(p->out_l);
-    fftw_destroy_plan(p->p_l);
-
-    if (p->audio_channels == 2) {
-        fftw_free(p->in_bass_r);
-        fftw_free(p->in_bass_r_raw);
-        fftw_free(p->out_bass_r);
-        fftw_destroy_plan(p->p_bass_r);
-
-        fftw_free(p->in_r);
-        fftw_free(p->out_r);
-        fftw_free(p->in_r_raw);
-        fftw_destroy_plan(p->p_r);
+    // keep the last taps - 1 groups for the next outputs, and the incomplete group after them
+    for (int i = 0; i < p->audio_channels * d; i++) {
+        double *in = p->decimator_in + i * length;
+        memmove(in, in + groups, taps * sizeof(double));
     }
+    p->decimator_pos -= groups * d;
+}
+
+// passes frames at the input rate through the decimator to the history
+static inline __attribute__((always_inline)) void
+decimate(struct cava_plan *p, const void *data, const enum sample_type type, int frames,
+         ptrdiff_t frame_stride, ptrdiff_t channel_stride) {
+    const int channels = p->audio_channels;
+    const int d = p->decimation;
+    const int length = CAVA_DECIMATOR_TAPS_PER_PHASE + CAVA_DECIMATOR_BLOCK;
+
+    int group = CAVA_DECIMATOR_TAPS_PER_PHASE - 1 + p->decimator_pos / d;
+    int phase = p->decimator_pos % d;
+    for (ptrdiff_t f = 0; f < frames; f++) {
+        for (int c = 0; c < channels; c++)
+            p->decimator_in[(c * d + phase) * length + group] =
+                read_sample(data, type, f * frame_stride + c * channel_stride);
+        p->decimator_pos++;
+        if (++phase == d) {
+            phase = 0;
+            group++;
+            if (p->decimator_pos == CAVA_DECIMATOR_BLOCK * d) {
+                decimator_flush(p);
+                group = CAVA_DECIMATOR_TAPS_PER_PHASE - 1;
+            }
+        }
+    }
+    decimator_flush(p);
+}
+
+// appends frames at the input rate to the history, decimating them first if the plan does.
+// always inlined into the cava_write_* functions so that every check of the
+// sample type is resolved at compile time
+static inline __attribute__((always_inline)) void
+write_history(struct cava_plan *p, const void *data, const enum sample_type type, int frames,
+              ptrdiff_t frame_stride, ptrdiff_t channel_stride) {
+    if (p->decimation > 1)
+        decimate(p, data, type, frames, frame_stride, channel_stride);
+    else
+        store_frames(p, data, type, frames, frame_stride, channel_stride);
+}
+
+// appends frames of the input to the history, or only the channels the plan analyzes, or their
+// mean, which are gathered into select_buffer a block at a time first
+static inline __attribute__((always_inline)) void
+write_input(struct cava_plan *p, const void *data, const enum sample_type type, int frames,
+            ptrdiff_t frame_stride, ptrdiff_t channel_stride) {
+    if (p->select_buffer == NULL) {
+        write_history(p, data, type, frames, frame_stride, channel_stride);
+        return;
+    }
+
+    const int mixed = __builtin_popcount(p->channel_mask);
+    for (ptrdiff_t done = 0; done < frames; done += CAVA_SELECT_BLOCK) {
+        int block = frames - done < CAVA_SELECT_BLOCK ? frames - done : CAVA_SELECT_BLOCK;
+        double *restrict out = p->select_buffer;
+        if (p->downmix)
+            memset(out, 0, block * sizeof(double));
+        for (int c = 0; c < p->input_channels; c++) {
+            if (!(p->channel_mask & 1u << c))
+                continue;
+            ptrdiff_t first = done * frame_stride + c * channel_stride;
+            if (p->downmix) {
+                for (int f = 0; f < block; f++)
+                    out[f] += read_sample(data, type, first + f * frame_stride);
+            } else {
+                for (int f = 0; f < block; f++)
+                    out[f] = read_sample(data, type, first + f * frame_stride);
+                out += CAVA_SELECT_BLOCK;
+            }
+        }
+        if (p->downmix && mixed > 1) {
+            for (int f = 0; f < block; f++)
+                out[f] /= mixed;
+        }
+        write_history(p, p->select_buffer, SAMPLE_DOUBLE, block, 1, CAVA_SELECT_BLOCK);
+    }
+}
+
+void cava_write_s16(struct cava_plan *p, const int16_t *data, int frames, ptrdiff_t frame_stride,
+                    ptrdiff_t channel_stride) {
+    write_input(p, data, SAMPLE_S16, frames, frame_stride, channel_stride);
+}
+
+void cava_write_s32(struct cava_plan *p, const int32_t *data, int frames, ptrdiff_t frame_stride,
+                    ptrdiff_t channel_stride) {
+    write_input(p, data, SAMPLE_S32, frames, frame_stride, channel_stride);
+}
+
+void cava_write_float(struct cava_plan *p, const float *data, int frames, ptrdiff_t frame_stride,
+                      ptrdiff_t channel_stride) {
+    write_input(p, data, SAMPLE_FLOAT, frames, frame_stride, channel_stride);
+}
+
+void cava_execute_pending(struct cava_plan *p, double *cava_out) {
+    process(p, p->pending_samples, p->pending_silence, cava_out);
+    p->pending_samples = 0;
+    p->pending_silence = 1;
+}
+
+void cava_execute(double *cava_in, int new_samples, double *cava_out, struct cava_plan *p) {
+
+    // do not overflow
+    if (new_samples > p->FFTbufferSize * p->input_channels * p->decimation) {
+        new_samples = p->FFTbufferSize * p->input_channels * p->decimation;
+    }
+
+    // the bass filters take whole frames
+    write_input(p, cava_in, SAMPLE_DOUBLE, new_samples / p->input_channels, p->input_channels, 1);
+
+    cava_execute_pending(p, cava_out);
+}
+
+void cava_execute_s16(const int16_t *cava_in, int new_samples, double *cava_out,
+                      struct cava_plan *p) {
+
+    // do not overflow
+    if (new_samples > p->FFTbufferSize * p->input_channels * p->decimation) {
+        new_samples = p->FFTbufferSize * p->input_channels * p->decimation;
+    }
+
+    write_input(p, cava_in, SAMPLE_S16, new_samples / p->input_channels, p->input_channels, 1);
+    cava_execute_pending(p, cava_out);
+}
+
+void cava_destroy(struct cava_plan *p) {
+
+    if (p->status == 0)
+        shared_release(p->shared);
+    if (p->pool != NULL)
+        pool_destroy(p->pool);
+
+    // the plan is the start of the arena holding all of its buffers
+    free(p);
 }
 
 #ifdef __ANDROID__
@@ -498,7 +1967,7 @@ JNIEXPORT jfloatArray JNICALL Java_com_karlstav_cava_MyGLRenderer_InitCava(
 
     plan =
         cava_init(number_of_bars_set, 44100, 1, 1, noise_reduction, lower_cut_off, higher_cut_off);
-    cava_in = (double *)malloc(plan->FFTbassbufferSize * sizeof(double));
+    cava_in = (double *)malloc(plan->input_buffer_size * sizeof(double));
     cava_out = (double *)malloc(plan->number_of_bars * sizeof(double));
     (*env)->SetFloatArrayRegion(env, cuttOffFreq, 0, plan->number_of_bars + 1,
                                 plan->cut_off_frequency);
@@ -23,9 +23,47 @@ SOFTWARE.
 extern "C" {
 #endif
 #pragma once
+#include <stddef.h>
 #include <stdint.h>
 
-#include <fftw3.h>
+#include "fft/fft.h"
+
+struct cava_shared;
+struct cava_pool;
+
+// the window function the FFTs run on the history through
+enum cava_window {
+    // the default, the narrowest main lobe, but leaks the most into far away bars
+    CAVA_WINDOW_HANN,
+    // side lobes below -90 dB, for the least leakage, with a main lobe twice as wide
+    CAVA_WINDOW_BLACKMAN_HARRIS,
+    // in between the two
+    CAVA_WINDOW_KAISER,
+};
+
+// how the bars are computed from the samples
+enum cava_engine {
+    // the default, an FFT over a window of the history, with the bass from a longer one
+    CAVA_ENGINE_FFT,
+    // a band-pass filter per bar, run on every sample written since the last execution,
+    // followed by an envelope follower. reacts within a read, rather than within the length of
+    // a window
+    CAVA_ENGINE_BIQUAD,
+};
+
+// the stages of an execution a plan can time, see cava_options.timing
+enum cava_stage {
+    // the window function, from the history into the FFT buffers
+    CAVA_STAGE_WINDOW,
+    // the FFTs, or the Goertzel filterbanks that replace them, or CAVA_ENGINE_BIQUAD's
+    // filterbank
+    CAVA_STAGE_FFT,
+    // summing up the bins of each bar
+    CAVA_STAGE_BANDS,
+    // eq, falloff, integral and autosens
+    CAVA_STAGE_SMOOTHING,
+    CAVA_STAGE_COUNT,
+};
 
 // cava_plan, parameters used internally by cavacore, do not modify these directly
 // only the cut off frequencies is of any potential interest to read out,
@@ -33,10 +71,17 @@ extern "C" {
 struct cava_plan {
     int FFTbassbufferSize;
     int FFTbufferSize;
+    // sizes the FFTs run at, their windows zero padded to them in high density mode,
+    // otherwise the same as the windows
+    int bass_fft_size, fft_size;
     int number_of_bars;
+    // the channels analyzed, see input_channels
     int audio_channels;
     int input_buffer_size;
     int rate;
+    // input of 88.2 kHz and above is decimated by this factor, and analyzed at analysis_rate
+    int decimation;
+    int analysis_rate;
     int bass_cut_off_bar;
     int sens_init;
     int autosens;
@@ -47,24 +92,112 @@ struct cava_plan {
     double sens;
     double framerate;
     double noise_reduction;
+    double gravity_mod, gravity_framerate; // falloff gravity, and the framerate it was made for
+
+    // the analysis for the plan's engine and workers, picked by cava_init
+    void (*analyze)(struct cava_plan *plan);
+
+    // the FFT plans and windows only depend on the FFT sizes and the window function, so plans
+    // with the same ones share one read-only copy of them, see cava_shared in cavacore.c.
+    // all channels run the same FFTs on their own buffers
+    struct cava_shared *shared;
+    const struct cava_fft *bass_fft, *fft;
 
-    fftw_plan p_bass_l, p_bass_r;
-    fftw_plan p_l, p_r;
+    // the FFT buffers of the channels one after the other, channel c's input at c * bass_fft_size
+    // and c * fft_size, and its output at c * bass_out_stride and c * out_stride. the strides
+    // round the outputs up to whole cache lines
+    double *in_bass, *in;
+    cava_complex *out_bass, *out;
+    int bass_out_stride, out_stride;
 
-    fftw_complex *out_bass_l, *out_bass_r;
-    fftw_complex *out_l, *out_r;
+    // threads that run the FFTs of the channels and of the bass alongside the one executing the
+    // plan, see cava_pool in cavacore.c. NULL unless workers is above 0 and fft_size is at
+    // least parallel_fft_size
+    struct cava_pool *pool;
+    int workers, parallel_fft_size;
 
-    double *bass_multiplier;
-    double *multiplier;
+    // an FFT whose bars only need a handful of bins is replaced by a Goertzel filterbank on
+    // them, see select_goertzel in cavacore.c. the counts are 0 where the FFT runs, the
+    // coefficients are 2 cos w, cos w and sin w of each bin
+    int goertzel_bass_count, goertzel_count;
+    int *goertzel_bass_bins, *goertzel_bins;
+    double *goertzel_bass_coeffs, *goertzel_coeffs;
+
+    const double *bass_multiplier;
+    const double *multiplier;
 
-    double *in_bass_r_raw, *in_bass_l_raw;
-    double *in_r_raw, *in_l_raw;
-    double *in_bass_r, *in_bass_l;
-    double *in_r, *in_l;
     double *prev_cava_out, *cava_mem;
-    double *input_buffer, *cava_peak;
+    double *cava_bands; // band magnitudes of the last analysis, before eq
+    double *cava_peak;
+
+    // the history of input samples, one ring of FFTbufferSize samples per channel, in
+    // input_buffer, or in history_s16 with CAVA_HISTORY_S16. history_pos is the next one to be
+    // written, which is also the oldest
+    double *input_buffer;
+    int16_t *history_s16;
+    int history_pos;
+
+    // the bass FFT runs on its own history, decimated by a cascade of half-band filters, with
+    // one ring of FFTbassbufferSize samples per channel. half_band_in holds the delay lines of
+    // the filters, bass_count counts the samples the first one took in, modulo the decimation
+    double *bass_history;
+    int bass_pos;
+    const double *half_band_taps;
+    double *half_band_in;
+    int half_band_pos[3];
+    int bass_count;
+
+    // samples that entered the history since the mid and treble FFT last ran, it runs again
+    // once there are hop of them, and the bass FFT likewise in samples of its own history.
+    // leftovers count towards the next hop, so that the FFTs run at a steady rate however the
+    // samples arrive. overlap is the percentage the hops were made for
+    int fresh, hop;
+    int bass_fresh, bass_hop;
+    enum cava_window window;
+    int overlap;
+    enum cava_engine engine;
+
+    // in high density mode a bar is the mean of the FFT magnitudes interpolated linearly between
+    // the bins, over its frequency range. the weights of bar n are dense_weights[dense_start[n]]
+    // up to dense_weights[dense_start[n + 1]], for the bins from FFTbuffer_lower_cut_off[n] on
+    int high_density;
+    int *dense_start;
+    double *dense_weights;
+
+    // CAVA_ENGINE_BIQUAD's coefficients per bar, with b1 0 and b2 -b0, and the factor its
+    // envelopes fall by per sample. then filter states and envelopes per channel bar
+    double *biquad_b0, *biquad_a1, *biquad_a2, *biquad_release;
+    double *biquad_z1, *biquad_z2, *biquad_env;
+
+    // with a decimation above 1 the input is low pass filtered and decimated before it enters
+    // the history. decimator_in holds the input frames not yet filtered, decimator_pos of them
+    double *decimator_taps;
+    double *decimator_in, *decimator_out;
+    int decimator_pos;
+
+    // the input has input_channels channels, of which the ones in channel_mask are analyzed,
+    // each as a channel of its own, or with downmix their mean as a single one. unless that is
+    // all of them as they are, a block of the input at a time is gathered into select_buffer
+    // first, as the channels analyzed
+    int input_channels;
+    unsigned int channel_mask;
+    int downmix;
+    double *select_buffer;
+
+    // with timing, the seconds each stage took in the last execution, added up over the
+    // channels and the threads they ran on. stages that did not run, like the FFTs in between
+    // two hops, are 0. job_time holds the window, FFT and bands times of each FFT, the bass ones
+    // after those of the mid and treble, until they are added up
+    int timing;
+    double stage_time[CAVA_STAGE_COUNT];
+    double *job_time;
+
+    // samples written since the last execution, and whether all of them were 0
+    int pending_samples;
+    int pending_silence;
 
     double *eq;
+    double *eq_norm;
 
     float *cut_off_frequency;
     int *FFTbuffer_lower_cut_off;
@@ -76,9 +209,10 @@ struct cava_plan {
 
 // number_of_bars, number of wanted bars per channel
 
-// rate, sample rate of input signal
+// rate, sample rate of input signal. rates of 88.2 kHz and above are decimated down to
+// between 44.1 and 88.2 kHz for the analysis, see cava_plan.decimation
 
-// channels, number of interleaved channels in input
+// channels, number of interleaved channels in input, 1 to CAVA_MAX_CHANNELS
 
 // autosens, toggle automatic sensitivity adjustment 1 = on, 0 = off
 // on, gives a dynamically adjusted output signal from 0 to 1
@@ -101,29 +235,153 @@ extern struct cava_plan *cava_init(int number_of_bars, unsigned int rate, int ch
                                    int autosens, double noise_reduction, int low_cut_off,
                                    int high_cut_off);
 
+// how cavacore keeps the history of input samples it runs the FFTs on
+enum cava_history_format {
+    // doubles, the default
+    CAVA_HISTORY_DOUBLE,
+    // 16 bit integers, converted while windowing.
+    // takes a quarter of the memory, input that is not 16 bit is rounded and saturated
+    CAVA_HISTORY_S16,
+};
+
+// cava_options, the parameters of cava_init plus the ones it leaves at their defaults
+struct cava_options {
+    int number_of_bars;
+    unsigned int rate;
+    int channels;
+    int autosens;
+    double noise_reduction;
+    int low_cut_off;
+    int high_cut_off;
+    enum cava_history_format history_format;
+    // the window function of the FFTs
+    enum cava_window window;
+    // percentage by which consecutive analysis windows overlap, up to 99. the FFTs then run
+    // once (100 - overlap)% of their window came in since the last time, and the bars keep
+    // their magnitudes in between. 0 runs the mid and treble FFT on every execution that has
+    // new samples, as cava always did, and the bass FFT every quarter of its window
+    int overlap;
+    // what computes the bars, the window and overlap only apply to the FFT
+    enum cava_engine engine;
+    // 1 for up to CAVA_DENSE_MAX_BARS bars, more than the FFTs have bins. the FFTs are zero
+    // padded and the bars interpolated between their bins, so that narrow bars follow the
+    // spectrum smoothly rather than being pushed up it where the bins are too few
+    int high_density;
+    // threads that run the FFTs concurrently with the caller of cava_execute, up to
+    // CAVA_MAX_WORKERS, 0 for none. every channel has an FFT of its own for the bass and one for
+    // the rest, so up to twice as many as there are channels run at once. they only start for
+    // plans whose mid and treble FFT has at least parallel_fft_size samples, 0 for
+    // CAVA_PARALLEL_FFT_SIZE, as handing smaller FFTs to them takes longer than running them one
+    // after another
+    int workers;
+    int parallel_fft_size;
+    // the channels to analyze, bit c for channel c of the input, 0 for all of them. the others
+    // are dropped as they come in. with downmix 1 the mean of these channels is analyzed as a
+    // single channel instead. either way the output has bars for each channel analyzed, in the
+    // order of the input, see cava_plan.audio_channels
+    unsigned int channel_mask;
+    int downmix;
+    // 1 to time the stages of each execution, see cava_plan.stage_time. costs a clock read per
+    // stage and FFT. CAVA_ENGINE_BIQUAD has no window or bands stage, its filterbank is timed
+    // as the FFTs
+    int timing;
+};
+
+// most channels of the input, enough for 7.1
+#define CAVA_MAX_CHANNELS 8
+
+// most bars per channel in high density mode
+#define CAVA_DENSE_MAX_BARS 4096
+
+// most threads of cava_options.workers, and the smallest FFT they run on by default
+#define CAVA_MAX_WORKERS 3
+#define CAVA_PARALLEL_FFT_SIZE 8192
+
+// cava_init_with_options, same as cava_init, with the parameters in options
+extern struct cava_plan *cava_init_with_options(const struct cava_options *options);
+
+// cava_reconfigure, changes the parameters of a plan, keeping as much of it as possible.
+// if rate, channels, the channels analyzed and history_format stay the same, the history of
+// input samples is kept, and so is the smoothing state as long as number_of_bars does, and the
+// FFT plans as long as window does. otherwise this is cava_destroy followed by
+// cava_init_with_options.
+
+// returns the plan to use from now on, which can be a different one, plan must not be
+// used anymore. if options are illegal, returns a plan with status -1 like cava_init.
+// the equalizer is reset to flat, see cava_set_equalizer
+extern struct cava_plan *cava_reconfigure(struct cava_plan *plan,
+                                          const struct cava_options *options);
+
+// cava_inherit, lets plan carry on from another plan with the same rate, channels, channels
+// analyzed and history_format, by taking over its history of input samples and its sensitivity,
+// and its smoothing state if the number of bars is the same too. does nothing otherwise.
+// this way a plan can be built ahead of time and replace from without a visible restart
+extern void cava_inherit(struct cava_plan *plan, const struct cava_plan *from);
+
 // cava_execute, executes visualization
 
 // cava_in, input buffer can be any size. internal buffers in cavacore is
-// 4096 * number of channels at 44100 samples rate, if new_samples is greater
-// then samples will be discarded. However it is recommended to use less
-// new samples per execution as this determines your framerate.
+// 4096 * number of channels at 44100 samples rate, FFTbufferSize * input_channels * decimation
+// of the plan in general, if new_samples is greater then samples will be discarded.
+// However it is recommended to use less new samples per execution as this
+// determines your framerate.
 // 512 samples at 44100 sample rate mono, gives about 86 frames per second.
 
 // new_samples, the number of samples in cava_in to be processed per execution
 // in case of async reading of data this number is allowed to vary from execution to execution
 
-// cava_out, output buffer. Size must be number of bars * number of channels. Bars will
-// be sorted from lowest to highest frequency. If stereo input channels are configured
-// then all left channel bars will be first then the right.
+// cava_out, output buffer. Size must be number of bars * number of channels analyzed, the
+// audio_channels of the plan. Bars will be sorted from lowest to highest frequency. If more
+// than one channel is analyzed then all bars of the first channel will be first, then those of
+// the second and so on.
 
 // plan, the cava_plan struct returned from cava_init
 
 // cava_execute assumes cava_in samples to be interleaved if more than one channel
-// only up to two channels are supported.
+// up to CAVA_MAX_CHANNELS channels are supported.
 extern void cava_execute(double *cava_in, int new_samples, double *cava_out,
                          struct cava_plan *plan);
 
-// cava_destroy, destroys the plan, frees up memory
+// cava_execute_s16, same as cava_execute, for 16 bit integer samples.
+// with a CAVA_HISTORY_S16 plan they are stored without any conversion
+extern void cava_execute_s16(const int16_t *cava_in, int new_samples, double *cava_out,
+                             struct cava_plan *plan);
+
+// cava_write_s16, cava_write_s32, cava_write_float, write samples straight into the
+// history of the plan without running the visualization, so that buffers of any of these
+// formats can be passed on as they are. cava_execute_pending then visualizes them.
+
+// data, frames, frame_stride, channel_stride, channel c of frame f is read from
+// data[f * frame_stride + c * channel_stride], strides count samples, not bytes.
+// interleaved input has a frame_stride of channels and a channel_stride of 1,
+// planar input a frame_stride of 1 and a channel_stride of the plane length.
+
+// samples are scaled to the range of 16 bit audio like the capture code of cava does it:
+// 32 bit integers are divided by 65535 and floats, expected in -1 to 1, multiplied by it.
+// if more frames are written than the history holds, only the newest ones are kept
+extern void cava_write_s16(struct cava_plan *plan, const int16_t *data, int frames,
+                           ptrdiff_t frame_stride, ptrdiff_t channel_stride);
+extern void cava_write_s32(struct cava_plan *plan, const int32_t *data, int frames,
+                           ptrdiff_t frame_stride, ptrdiff_t channel_stride);
+extern void cava_write_float(struct cava_plan *plan, const float *data, int frames,
+                             ptrdiff_t frame_stride, ptrdiff_t channel_stride);
+
+// cava_execute_pending, executes visualization on the samples written since the last execution
+// cava_out and plan are the same as for cava_execute, which is cava_execute_pending after
+// writing new_samples from cava_in
+extern void cava_execute_pending(struct cava_plan *plan, double *cava_out);
+
+// cava_set_equalizer, applies a user gain curve on top of the internal eq
+
+// gains, key_count gain factors spread evenly from the lowest to the highest bar,
+// each bar gets a gain linearly interpolated between its two nearest keys.
+// NULL or a key_count of 0 resets the curve to flat.
+
+// the gains are folded into the per bar eq table used by cava_execute, so this
+// should be called when the curve changes, not per execution.
+extern void cava_set_equalizer(struct cava_plan *plan, const double *gains, int key_count);
+
+// cava_destroy, destroys the plan, frees up all of its memory including the plan itself
 extern void cava_destroy(struct cava_plan *plan);
 
 #ifdef __cplusplus
@@ -0,0 +1,168 @@
+// built-in backend of cavacore's FFTs. the real samples are taken as complex pairs, run through
+// a split-radix FFT of half the size, and the spectrum of the real samples is untangled from
+// its output. every twiddle factor is computed when the FFT is made, into a table for each size
+// the recursion goes through, so planning takes a sin and cos per bin and no measurements.
+// the same recursion runs every size, only the 4, 8 and 16 point leaves are written out
+
+#include <math.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#include "fft.h"
+
+#ifndef M_PI
+#define M_PI 3.1415926535897932385
+#endif
+
+const char cava_fft_backend[] = "builtin";
+
+struct cava_fft {
+    int size;
+    // for each size n of the complex FFT from 16 on, e^(-2 pi i k / n) and e^(-2 pi i 3k / n)
+    // of k from 0 to n / 4, one after the other, starting at pair n / 4 - 4
+    cava_complex *twiddles;
+    // e^(-2 pi i k / size) of k from 0 to size / 4, to untangle the real spectrum
+    cava_complex *untangle;
+};
+
+// 4 point DFT of in[0], in[s], in[2s] and in[3s]
+static inline void dft4(const cava_complex *in, ptrdiff_t s, cava_complex *out) {
+    double t0r = in[0][0] + in[2 * s][0], t0i = in[0][1] + in[2 * s][1];
+    double t1r = in[0][0] - in[2 * s][0], t1i = in[0][1] - in[2 * s][1];
+    double t2r = in[s][0] + in[3 * s][0], t2i = in[s][1] + in[3 * s][1];
+    double t3r = in[s][0] - in[3 * s][0], t3i = in[s][1] - in[3 * s][1];
+    out[0][0] = t0r + t2r;
+    out[0][1] = t0i + t2i;
+    out[1][0] = t1r + t3i;
+    out[1][1] = t1i - t3r;
+    out[2][0] = t0r - t2r;
+    out[2][1] = t0i - t2i;
+    out[3][0] = t1r - t3i;
+    out[3][1] = t1i + t3r;
+}
+
+// the split-radix butterflies of an FFT of 4q points, whose first half holds the DFT of the
+// even points, the third quarter the DFT of points 4m + 1 and the last the one of points 4m + 3
+static inline void combine(cava_complex *restrict out, int q, const cava_complex *restrict tw) {
+    for (int k = 0; k < q; k++) {
+        const double *w1 = tw[2 * k], *w3 = tw[2 * k + 1];
+        double *a = out[2 * q + k], *b = out[3 * q + k];
+        double zr = w1[0] * a[0] - w1[1] * a[1], zi = w1[0] * a[1] + w1[1] * a[0];
+        double yr = w3[0] * b[0] - w3[1] * b[1], yi = w3[0] * b[1] + w3[1] * b[0];
+        double sr = zr + yr, si = zi + yi;
+        double dr = zr - yr, di = zi - yi;
+        double u0r = out[k][0], u0i = out[k][1];
+        double u1r = out[q + k][0], u1i = out[q + k][1];
+        out[k][0] = u0r + sr;
+        out[k][1] = u0i + si;
+        out[2 * q + k][0] = u0r - sr;
+        out[2 * q + k][1] = u0i - si;
+        // plus and minus -i times the difference
+        out[q + k][0] = u1r + di;
+        out[q + k][1] = u1i - dr;
+        out[3 * q + k][0] = u1r - di;
+        out[3 * q + k][1] = u1i + dr;
+    }
+}
+
+// 8 point DFT of in[0], in[s] up to in[7s], the smallest FFT that is split up, with its
+// twiddles written out
+static inline void dft8(const cava_complex *in, ptrdiff_t s, cava_complex *out) {
+    static const cava_complex twiddles[4] = {
+        {1, 0}, {1, 0}, {M_SQRT1_2, -M_SQRT1_2}, {-M_SQRT1_2, -M_SQRT1_2}};
+    dft4(in, 2 * s, out);
+    for (int j = 0; j < 2; j++) {
+        const double *x = in[(2 * j + 1) * s], *y = in[(2 * j + 5) * s];
+        out[4 + 2 * j][0] = x[0] + y[0];
+        out[4 + 2 * j][1] = x[1] + y[1];
+        out[5 + 2 * j][0] = x[0] - y[0];
+        out[5 + 2 * j][1] = x[1] - y[1];
+    }
+    combine(out, 2, twiddles);
+}
+
+// complex FFT of the n points in[0], in[s] and so on into out, n is a power of two from 4 on
+static void split_radix(const struct cava_fft *fft, const cava_complex *in, ptrdiff_t s,
+                        cava_complex *out, int n) {
+    if (n == 4) {
+        dft4(in, s, out);
+        return;
+    }
+    if (n == 8) {
+        dft8(in, s, out);
+        return;
+    }
+    int q = n / 4;
+    if (n == 16) {
+        // most of the calls end here, so the three leaves are made without recursing
+        dft8(in, 2 * s, out);
+        dft4(in + s, 4 * s, out + 8);
+        dft4(in + 3 * s, 4 * s, out + 12);
+        combine(out, 4, fft->twiddles);
+        return;
+    }
+    split_radix(fft, in, 2 * s, out, 2 * q);
+    split_radix(fft, in + s, 4 * s, out + 2 * q, q);
+    split_radix(fft, in + 3 * s, 4 * s, out + 3 * q, q);
+    combine(out, q, fft->twiddles + 2 * (q - 4));
+}
+
+struct cava_fft *cava_fft_plan(int size) {
+    if (size < 16 || (size & (size - 1)) != 0)
+        return NULL;
+    int m = size / 2;
+
+    // the struct and both tables in one block
+    size_t twiddle_count = m > 8 ? m - 8 : 0;
+    struct cava_fft *fft = malloc(sizeof(struct cava_fft) +
+                                  (twiddle_count + m / 2 + 1) * sizeof(cava_complex));
+    if (fft == NULL)
+        return NULL;
+    fft->size = size;
+    fft->twiddles = (cava_complex *)(fft + 1);
+    fft->untangle = fft->twiddles + twiddle_count;
+
+    for (int n = 16; n <= m; n *= 2) {
+        cava_complex *tw = fft->twiddles + 2 * (n / 4 - 4);
+        for (int k = 0; k < n / 4; k++) {
+            tw[2 * k][0] = cos(2 * M_PI * k / n);
+            tw[2 * k][1] = -sin(2 * M_PI * k / n);
+            tw[2 * k + 1][0] = cos(2 * M_PI * 3 * k / n);
+            tw[2 * k + 1][1] = -sin(2 * M_PI * 3 * k / n);
+        }
+    }
+    for (int k = 0; k <= m / 2; k++) {
+        fft->untangle[k][0] = cos(2 * M_PI * k / size);
+        fft->untangle[k][1] = -sin(2 * M_PI * k / size);
+    }
+    return fft;
+}
+
+void cava_fft_execute(const struct cava_fft *fft, double *in, cava_complex *out) {
+    int m = fft->size / 2;
+    // z[j] = in[2j] + i in[2j + 1], Z its FFT
+    split_radix(fft, (const cava_complex *)in, 1, out, m);
+
+    // Z[k] is E[k] + i O[k], the FFTs of the even and odd samples, and the spectrum of the
+    // real samples X[k] = E[k] + e^(-2 pi i k / size) O[k]. E and O are spectra of real
+    // samples themselves, so E[m - k] and O[m - k] are the conjugates of E[k] and O[k], and
+    // X[m - k] is the conjugate of E[k] - e^(-2 pi i k / size) O[k]. P is O[k] here
+    double z0r = out[0][0], z0i = out[0][1];
+    out[0][0] = z0r + z0i;
+    out[0][1] = 0;
+    out[m][0] = z0r - z0i;
+    out[m][1] = 0;
+    for (int k = 1; k <= m / 2; k++) {
+        double *a = out[k], *b = out[m - k];
+        const double *w = fft->untangle[k];
+        double er = (a[0] + b[0]) / 2, ei = (a[1] - b[1]) / 2;
+        double pr = (a[1] + b[1]) / 2, pi = (b[0] - a[0]) / 2;
+        double tr = w[0] * pr - w[1] * pi, ti = w[0] * pi + w[1] * pr;
+        b[0] = er - tr;
+        b[1] = ti - ei;
+        a[0] = er + tr;
+        a[1] = ei + ti;
+    }
+}
+
+void cava_fft_destroy(struct cava_fft *fft) { free(fft); }
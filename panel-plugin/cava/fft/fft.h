@@ -0,0 +1,25 @@
+// header file for the FFT backends, part of cava.
+// one of them is built into cavacore, picked by the fft meson option
+
+#pragma once
+
+// a complex number, real part first, laid out like fftw_complex
+typedef double cava_complex[2];
+
+// a real FFT of one size, made once and then run on any buffers
+struct cava_fft;
+
+// name of the backend cavacore was built with
+extern const char cava_fft_backend[];
+
+// cava_fft_plan, makes an FFT of size real samples to size / 2 + 1 complex bins, size is a
+// power of two from 16 on. returns NULL if it could not be made.
+// planning is not thread safe, neither is cava_fft_destroy
+extern struct cava_fft *cava_fft_plan(int size);
+
+// cava_fft_execute, runs fft on size samples of in into the size / 2 + 1 bins of out, without
+// scaling. in and out must be aligned to 64 bytes and are not to overlap, in may be clobbered.
+// can run on separate buffers from any number of threads at once
+extern void cava_fft_execute(const struct cava_fft *fft, double *in, cava_complex *out);
+
+extern void cava_fft_destroy(struct cava_fft *fft);
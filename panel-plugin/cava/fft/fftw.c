@@ -0,0 +1,49 @@
+// FFTW backend of cavacore's FFTs
+
+#include <stdlib.h>
+
+#include <fftw3.h>
+
+#include "fft.h"
+
+const char cava_fft_backend[] = "fftw";
+
+struct cava_fft {
+    fftw_plan plan;
+};
+
+struct cava_fft *cava_fft_plan(int size) {
+    struct cava_fft *fft = malloc(sizeof(struct cava_fft));
+    // the plan is made on scratch buffers with the alignment of the buffers it will run on,
+    // as fftw_execute_dft_r2c requires
+    double *in = NULL;
+    fftw_complex *out = NULL;
+    if (fft == NULL || posix_memalign((void **)&in, 64, size * sizeof(double)) != 0 ||
+        posix_memalign((void **)&out, 64, (size / 2 + 1) * sizeof(fftw_complex)) != 0) {
+        free(fft);
+        free(in);
+        return NULL;
+    }
+
+    int fftw_flag = FFTW_MEASURE;
+#ifdef __ANDROID__
+    fftw_flag = FFTW_ESTIMATE;
+#endif
+    fft->plan = fftw_plan_dft_r2c_1d(size, in, out, fftw_flag);
+    free(in);
+    free(out);
+    if (fft->plan == NULL) {
+        free(fft);
+        return NULL;
+    }
+    return fft;
+}
+
+void cava_fft_execute(const struct cava_fft *fft, double *in, cava_complex *out) {
+    fftw_execute_dft_r2c(fft->plan, in, out);
+}
+
+void cava_fft_destroy(struct cava_fft *fft) {
+    fftw_destroy_plan(fft->plan);
+    free(fft);
+}
@@ -1,23 +1,73 @@
 #include "common.h"
+#include "cavacore.h"
+#include "stats.h"
 #include <limits.h>
 #include <math.h>
 #include <string.h>
 
-int write_to_cava_input_buffers(int16_t samples, unsigned char *buf, void *data) {
+static void clear_cava_in(struct audio_data *audio) {
+    if (audio->cava_in_s16)
+        memset(audio->cava_in_s16, 0, audio->cava_buffer_size * sizeof(int16_t));
+    else
+        memset(audio->cava_in, 0, audio->cava_buffer_size * sizeof(double));
+}
+
+// records how long a write took, and when the samples of the next frame started coming in,
+// with the lock held
+static void record_write(struct audio_data *audio, uint64_t start) {
+    if (audio->stats == NULL)
+        return;
+    stats_record_since(audio->stats, STATS_CAPTURE, start);
+    if (audio->stats->handoff_ns == 0)
+        audio->stats->handoff_ns = start;
+}
+
+int write_to_cava_input_buffers(int samples, unsigned char *buf, void *data) {
     if (samples == 0)
         return 0;
     struct audio_data *audio = (struct audio_data *)data;
     pthread_mutex_lock(&audio->lock);
+    uint64_t start = audio->stats ? stats_now() : 0;
     int bytes_per_sample = audio->format / 8;
+    if (audio->plan) {
+        // straight into the history of the analysis, without a copy
+        int frames = samples / audio->channels;
+        if (bytes_per_sample == 2)
+            cava_write_s16(audio->plan, (int16_t *)buf, frames, audio->channels, 1);
+        else if (audio->IEEE_FLOAT)
+            cava_write_float(audio->plan, (float *)buf, frames, audio->channels, 1);
+        else
+            cava_write_s32(audio->plan, (int32_t *)buf, frames, audio->channels, 1);
+        record_write(audio, start);
+        pthread_mutex_unlock(&audio->lock);
+        return 0;
+    }
+    if (samples > audio->cava_buffer_size) {
+        // more than cava_in holds at once, only the newest whole frames are kept
+        int skip = samples - audio->cava_buffer_size;
+        skip = (skip + audio->channels - 1) / audio->channels * audio->channels;
+        if (audio->stats)
+            audio->stats->dropped_samples += skip;
+        buf += skip * bytes_per_sample;
+        samples -= skip;
+    }
     if (audio->samples_counter + samples > audio->cava_buffer_size) {
         // buffer overflow, discard what ever is in the buffer and start over
-        for (uint16_t n = 0; n < audio->cava_buffer_size; n++) {
-            audio->cava_in[n] = 0;
-        }
+        if (audio->stats)
+            audio->stats->dropped_samples += audio->samples_counter;
+        clear_cava_in(audio);
         audio->samples_counter = 0;
     }
+    if (audio->cava_in_s16) {
+        // 16 bit samples are kept as they are
+        memcpy(audio->cava_in_s16 + audio->samples_counter, buf, samples * sizeof(int16_t));
+        audio->samples_counter += samples;
+        record_write(audio, start);
+        pthread_mutex_unlock(&audio->lock);
+        return 0;
+    }
     int n = 0;
-    for (uint16_t i = 0; i < samples; i++) {
+    for (int i = 0; i < samples; i++) {
         switch (bytes_per_sample) {
         case 1:;
             int8_t *buf8 = (int8_t *)&buf[n];
@@ -41,6 +91,7 @@ int write_to_cava_input_buffers(int16_t samples, unsigned char *buf, void *data)
         n += bytes_per_sample;
     }
     audio->samples_counter += samples;
+    record_write(audio, start);
     pthread_mutex_unlock(&audio->lock);
     return 0;
 }
@@ -48,9 +99,7 @@ int write_to_cava_input_buffers(int16_t samples, unsigned char *buf, void *data)
 void reset_output_buffers(struct audio_data *data) {
     struct audio_data *audio = (struct audio_data *)data;
     pthread_mutex_lock(&audio->lock);
-    for (uint16_t n = 0; n < audio->cava_buffer_size; n++) {
-        audio->cava_in[n] = 0;
-    }
+    clear_cava_in(audio);
     audio->samples_counter = audio->cava_buffer_size;
     pthread_mutex_unlock(&audio->lock);
 }
@@ -15,8 +15,14 @@
 // number of samples to read from audio source per channel
 #define BUFFER_SIZE 512
 
+struct cava_plan;
+struct CavaStats;
+
 struct audio_data {
     double *cava_in;
+    int16_t *cava_in_s16; // used instead of cava_in when format is 16, passed to cava_execute_s16
+    struct cava_plan *plan; // if set, samples are written into its history instead of cava_in
+    struct CavaStats *stats; // if set, the writes are timed into it
 
     int input_buffer_size;
     int cava_buffer_size;
@@ -43,6 +49,6 @@ void reset_output_buffers(struct audio_data *data);
 void signal_threadparams(struct audio_data *data);
 void signal_terminate(struct audio_data *data);
 
-int write_to_cava_input_buffers(int16_t size, unsigned char *buf, void *data);
+int write_to_cava_input_buffers(int size, unsigned char *buf, void *data);
 
 extern pthread_mutex_t lock;
@@ -114,6 +114,22 @@ static void on_stream_param_changed(void *_data, uint32_t id, const struct spa_p
     spa_format_audio_raw_parse(param, &data->format.info.raw);
 }
 
+// positions of the channels of a remixed stream by their count, in the usual
+// order of 2.1 up to 7.1, which is the one the plugin groups them by
+static const uint32_t remix_positions[][8] = {
+    [2] = {SPA_AUDIO_CHANNEL_FL, SPA_AUDIO_CHANNEL_FR},
+    [3] = {SPA_AUDIO_CHANNEL_FL, SPA_AUDIO_CHANNEL_FR, SPA_AUDIO_CHANNEL_LFE},
+    [4] = {SPA_AUDIO_CHANNEL_FL, SPA_AUDIO_CHANNEL_FR, SPA_AUDIO_CHANNEL_RL, SPA_AUDIO_CHANNEL_RR},
+    [5] = {SPA_AUDIO_CHANNEL_FL, SPA_AUDIO_CHANNEL_FR, SPA_AUDIO_CHANNEL_FC, SPA_AUDIO_CHANNEL_RL,
+           SPA_AUDIO_CHANNEL_RR},
+    [6] = {SPA_AUDIO_CHANNEL_FL, SPA_AUDIO_CHANNEL_FR, SPA_AUDIO_CHANNEL_FC, SPA_AUDIO_CHANNEL_LFE,
+           SPA_AUDIO_CHANNEL_RL, SPA_AUDIO_CHANNEL_RR},
+    [7] = {SPA_AUDIO_CHANNEL_FL, SPA_AUDIO_CHANNEL_FR, SPA_AUDIO_CHANNEL_FC, SPA_AUDIO_CHANNEL_LFE,
+           SPA_AUDIO_CHANNEL_SL, SPA_AUDIO_CHANNEL_SR, SPA_AUDIO_CHANNEL_RC},
+    [8] = {SPA_AUDIO_CHANNEL_FL, SPA_AUDIO_CHANNEL_FR, SPA_AUDIO_CHANNEL_FC, SPA_AUDIO_CHANNEL_LFE,
+           SPA_AUDIO_CHANNEL_RL, SPA_AUDIO_CHANNEL_RR, SPA_AUDIO_CHANNEL_SL, SPA_AUDIO_CHANNEL_SR},
+};
+
 static const struct pw_stream_events stream_events = {
     PW_VERSION_STREAM_EVENTS,
     .state_changed = on_stream_state_changed,
@@ -206,23 +222,16 @@ void *input_pipewire(void *audiodata) {
         pw_properties_set(props, PW_KEY_STREAM_DONT_REMIX, "false");
         pw_properties_set(props, "channelmix.upmix", "true");
 
-        if (data.cava_audio->channels < 2) {
-            // N to 1 with all channels shown
-            params[0] = spa_format_audio_raw_build(
-                &b, SPA_PARAM_EnumFormat,
-                &SPA_AUDIO_INFO_RAW_INIT(.format = audio_format, .rate = data.cava_audio->rate,
-                                         .channels = data.cava_audio->channels, ));
-        } else {
-            // N to 2 with all channels shown
-            params[0] = spa_format_audio_raw_build(
-                &b, SPA_PARAM_EnumFormat,
-                &SPA_AUDIO_INFO_RAW_INIT(.format = audio_format, .rate = data.cava_audio->rate,
-                                         .channels = data.cava_audio->channels,
-                                         .position = {SPA_AUDIO_CHANNEL_FL,
-                                                      SPA_AUDIO_CHANNEL_FR}, ));
-        }
+        // N to 1, 2 or a surround layout with all channels shown
+        struct spa_audio_info_raw info = SPA_AUDIO_INFO_RAW_INIT(
+            .format = audio_format, .rate = data.cava_audio->rate,
+            .channels = data.cava_audio->channels, );
+        unsigned int channels = data.cava_audio->channels;
+        if (channels >= 2 && channels < SPA_N_ELEMENTS(remix_positions))
+            memcpy(info.position, remix_positions[channels], channels * sizeof(uint32_t));
+        params[0] = spa_format_audio_raw_build(&b, SPA_PARAM_EnumFormat, &info);
     } else {
-        // N to 2 with only FL and FR shown
+        // the first channels of the stream as they are, only FL and FR for 2
         params[0] = spa_format_audio_raw_build(
             &b, SPA_PARAM_EnumFormat,
             &SPA_AUDIO_INFO_RAW_INIT(.format = audio_format, .rate = data.cava_audio->rate,
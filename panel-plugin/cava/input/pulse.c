@@ -101,7 +101,7 @@ void getPulseDefaultSink(void *data) {
 void *input_pulse(void *data) {
 
     struct audio_data *audio = (struct audio_data *)data;
-    uint16_t buffer_size = audio->input_buffer_size * audio->format / 8;
+    int buffer_size = audio->input_buffer_size * audio->format / 8;
     unsigned char buf[buffer_size];
 
     /* The sample type to use */
@@ -68,8 +68,11 @@ enum {
     UPDATE_STYLES = 1, // update CSS styles
     UPDATE_SIZE = 2, // resize display
     UPDATE_COLORS = 4, // reconfigure bar colors
-    UPDATE_CONFIG = 8, // reallocate buffers and cava plan
+    UPDATE_CONFIG = 8, // rebuild buffers and cava plan in the background
     UPDATE_ALL = 16, // reconfigure and reallocate everything
+    UPDATE_EQUALIZER = 32, // reapply the equalizer to the cava plan
+    UPDATE_PLAN = 64, // reconfigure the cava plan in place
+    UPDATE_STATS = 128, // start or stop collecting statistics
 } UpdateEvent;
 
 typedef struct {
@@ -88,14 +91,17 @@ static void setting_changed(SettingChanged *sc) {
         restyle_display(sc->cava);
     if (u & UPDATE_COLORS)
         config_colors(sc->cava);
-    if (u & UPDATE_CONFIG) {
-        free_cava(sc->cava);
-        config_cava(sc->cava); // includes colors update
-    }
+    if (u & UPDATE_EQUALIZER)
+        config_equalizer(sc->cava);
+    if (u & UPDATE_PLAN)
+        config_plan(sc->cava); // includes equalizer update
+    if (u & UPDATE_STATS)
+        config_stats(sc->cava); // includes plan update
+    if (u & UPDATE_CONFIG)
+        rebuild_cava(sc->cava); // includes colors update
     if (u & UPDATE_ALL) {
         resize_display(sc->cava);
-        free_cava(sc->cava);
-        config_cava(sc->cava);
+        rebuild_cava(sc->cava);
     }
 }
 
@@ -188,7 +194,7 @@ static void color_button_changed(GtkColorButton *widget, SettingChanged *sc) {
 
 static void scale_value_changed(GtkScale *widget, SettingChanged *sc) {
     gdouble value = gtk_range_get_value(GTK_RANGE(widget));
-    if (value != *(gint *)sc->setting) {
+    if (value != *(gdouble *)sc->setting) {
         *(gdouble *)sc->setting = value;
         setting_changed(sc);
     }
@@ -200,6 +206,7 @@ static void reset_equalizer_button(GtkButton *widget, CavaPlugin *c) {
         gtk_range_set_value(GTK_RANGE(c->equalizer_scales[i]), 
                 c->settings.equalizer_keys[i]);
     }
+    config_equalizer(c);
 }
 
 static void text_buffer_changed(GtkTextBuffer *widget, SettingChanged *sc) {
@@ -322,6 +329,120 @@ static void create_text_view(CavaPlugin *c, GtkWidget *container,
     SETTING_CHANGED_INIT(buffer, "changed", text_buffer_changed);
 }
 
+// how often the statistics page is refreshed, in milliseconds
+#define STATS_REFRESH 500
+
+// The labels of the statistics page: min, mean, p99 and count of each
+// stage, then the counters.
+typedef struct {
+    CavaPlugin *cava;
+    GtkWidget *stages[STATS_STAGE_COUNT][4];
+    GtkWidget *frames, *skipped_frames, *repaints, *dropped_samples;
+    guint timeout_id;
+} StatsPage;
+
+static void set_label_us(GtkWidget *label, uint64_t ns) {
+    gchar *text = g_strdup_printf("%.1f", ns / 1000.0);
+    gtk_label_set_text(GTK_LABEL(label), text);
+    g_free(text);
+}
+
+static void set_label_count(GtkWidget *label, uint64_t count) {
+    gchar *text = g_strdup_printf("%" G_GUINT64_FORMAT, (guint64)count);
+    gtk_label_set_text(GTK_LABEL(label), text);
+    g_free(text);
+}
+
+static gboolean refresh_stats_page(StatsPage *page) {
+    CavaPlugin *c = page->cava;
+    // the audio thread records the capture stages with the lock held
+    CavaStats stats = {0};
+    pthread_mutex_lock(&c->audio.lock);
+    if (c->stats)
+        stats = *c->stats;
+    pthread_mutex_unlock(&c->audio.lock);
+    for (int stage = 0; stage < STATS_STAGE_COUNT; stage++) {
+        StatsHistogram *h = &stats.stages[stage];
+        if (h->count == 0) {
+            for (int i = 0; i < 4; i++)
+                gtk_label_set_text(GTK_LABEL(page->stages[stage][i]), "-");
+            continue;
+        }
+        set_label_us(page->stages[stage][0], h->min_ns);
+        set_label_us(page->stages[stage][1], h->total_ns / h->count);
+        set_label_us(page->stages[stage][2], stats_percentile(h, 0.99));
+        set_label_count(page->stages[stage][3], h->count);
+    }
+    set_label_count(page->frames, stats.frames);
+    set_label_count(page->skipped_frames, stats.skipped_frames);
+    set_label_count(page->repaints, stats.repaints);
+    set_label_count(page->dropped_samples, stats.dropped_samples);
+    return TRUE;
+}
+
+static void stats_page_destroyed(GtkWidget *widget, StatsPage *page) {
+    g_source_remove(page->timeout_id);
+    g_slice_free(StatsPage, page);
+}
+
+static void reset_stats_button(GtkButton *widget, CavaPlugin *c) {
+    pthread_mutex_lock(&c->audio.lock);
+    if (c->stats)
+        stats_reset(c->stats);
+    pthread_mutex_unlock(&c->audio.lock);
+}
+
+static GtkWidget *add_stats_label(GtkWidget *grid, const gchar *text,
+        gint column, gint row) {
+    GtkWidget *label = gtk_label_new(text);
+    gtk_label_set_xalign(GTK_LABEL(label), column == 0 ? 0.0 : 1.0);
+    gtk_grid_attach(GTK_GRID(grid), label, column, row, 1, 1);
+    return label;
+}
+
+// Builds the statistics page into container, a table of the time each
+// stage of a frame takes and the counters, refreshed while it exists.
+static void create_stats_page(CavaPlugin *c, GtkWidget *container) {
+    StatsPage *page = g_slice_new0(StatsPage);
+    page->cava = c;
+    GtkWidget *grid = gtk_grid_new();
+    gtk_grid_set_row_spacing(GTK_GRID(grid), 4);
+    gtk_grid_set_column_spacing(GTK_GRID(grid), 16);
+    const gchar *headers[] = {
+        "Stage",
+        "Min (\u00b5s)",
+        "Mean (\u00b5s)",
+        "p99 (\u00b5s)",
+        "Count",
+    };
+    for (int i = 0; i < (int)ARRAY_SIZE(headers); i++) {
+        GtkWidget *label = add_stats_label(grid, headers[i], i, 0);
+        gtk_style_context_add_class(
+                gtk_widget_get_style_context(label), "dim-label");
+    }
+    for (int stage = 0; stage < STATS_STAGE_COUNT; stage++) {
+        add_stats_label(grid, stats_stage_name(stage), 0, stage + 1);
+        for (int i = 0; i < 4; i++)
+            page->stages[stage][i] =
+                add_stats_label(grid, "-", i + 1, stage + 1);
+    }
+    gint row = STATS_STAGE_COUNT + 1;
+    add_stats_label(grid, "Frames", 0, row);
+    page->frames = add_stats_label(grid, "0", 4, row++);
+    add_stats_label(grid, "Skipped frames", 0, row);
+    page->skipped_frames = add_stats_label(grid, "0", 4, row++);
+    add_stats_label(grid, "Repaints", 0, row);
+    page->repaints = add_stats_label(grid, "0", 4, row++);
+    add_stats_label(grid, "Dropped samples", 0, row);
+    page->dropped_samples = add_stats_label(grid, "0", 4, row++);
+    gtk_box_pack_start(GTK_BOX(container), grid, FALSE, FALSE, 0);
+
+    refresh_stats_page(page);
+    page->timeout_id = g_timeout_add(
+            STATS_REFRESH, (GSourceFunc)refresh_stats_page, page);
+    g_signal_connect(grid, "destroy", G_CALLBACK(stats_page_destroyed), page);
+}
+
 static double logspace(double start, double stop, int n, int N) {
     return start * pow(stop / start, n / (double)(N - 1));
 }
@@ -367,7 +488,7 @@ void plugin_configure (XfcePanelPlugin *plugin, CavaPlugin *c) {
 
     GtkSizeGroup *sg = gtk_size_group_new(GTK_SIZE_GROUP_HORIZONTAL);
 
-    create_spin_button(c, vbox, sg, UPDATE_ALL, "Bars:", &s->bars, 1, 512);
+    create_spin_button(c, vbox, sg, UPDATE_ALL, "Bars:", &s->bars, 1, 4096);
     create_spin_button(c, vbox, sg, UPDATE_SIZE, "Bar Width:", &s->bar_width, 1, 100);
     create_spin_button(c, vbox, sg, UPDATE_SIZE, "Bar Spacing:", &s->bar_spacing, 0, 10);
 
@@ -393,18 +514,43 @@ void plugin_configure (XfcePanelPlugin *plugin, CavaPlugin *c) {
     create_spin_button(c, vbox, sg, UPDATE_NONE, "Sleep Timer (s):", &s->sleep_timer, 0, 1000);
     create_spin_button(c, vbox, sg, UPDATE_NONE, "Sensitivity (%):", &s->sensitivity, 1, 1000);
     create_spin_button(
-            c, vbox, sg, UPDATE_CONFIG, "Low frequency (Hz):", &s->lower_cutoff_freq, 0, 22000);
+            c, vbox, sg, UPDATE_PLAN, "Low frequency (Hz):", &s->lower_cutoff_freq, 0, 22000);
     create_spin_button(
-            c, vbox, sg, UPDATE_CONFIG, "High frequency (Hz):", &s->higher_cutoff_freq, 0, 22000);
+            c, vbox, sg, UPDATE_PLAN, "High frequency (Hz):", &s->higher_cutoff_freq, 0, 22000);
+
+    // Analysis
+    const gchar* windows[] = {
+        "Hann",
+        "Blackman-Harris",
+        "Kaiser",
+    };
+    create_combo_box(c, vbox, sg, UPDATE_PLAN, "Window:", 
+            windows, ARRAY_SIZE(windows), &s->window);
+    create_spin_button(c, vbox, sg, UPDATE_PLAN, "Overlap (%):", &s->overlap, 0, 99);
+    const gchar* engines[] = {
+        "FFT",
+        "Filterbank",
+    };
+    create_combo_box(c, vbox, sg, UPDATE_PLAN, "Engine:", 
+            engines, ARRAY_SIZE(engines), &s->engine);
+    create_check_button(c, vbox, sg, UPDATE_PLAN, "High density", &s->high_density);
+    create_spin_button(c, vbox, sg, UPDATE_PLAN, "FFT threads:", &s->workers, 0, 3);
     gtk_box_pack_start(GTK_BOX(vbox), 
             gtk_separator_new(GTK_ORIENTATION_HORIZONTAL), FALSE, FALSE, 4);
 
     // Stereo
     create_check_button(c, vbox, sg, UPDATE_ALL, "Stereo", &s->stereo);
+    const gchar* layouts[] = {
+        "Grouped",
+        "Separate",
+    };
+    create_combo_box(c, vbox, sg, UPDATE_ALL, "Channels:", 
+            layouts, ARRAY_SIZE(layouts), &s->layout);
+    create_check_button(c, vbox, sg, UPDATE_ALL, "Downmix mono", &s->downmix);
 
     create_spin_button(c, vbox, sg, UPDATE_NONE, "Smoothing (%):", &s->monstercat, 0, 100);
     create_check_button(c, vbox, sg, UPDATE_NONE, "Waves", &s->waves);
-    create_spin_button(c, vbox, sg, UPDATE_ALL, "Noise Reduction (%):", &s->noise_reduction, 0, 100);
+    create_spin_button(c, vbox, sg, UPDATE_PLAN, "Noise Reduction (%):", &s->noise_reduction, 0, 100);
 
     // Colors
     GtkWidget *vbox2 = gtk_box_new(GTK_ORIENTATION_VERTICAL, 8);
@@ -453,7 +599,7 @@ void plugin_configure (XfcePanelPlugin *plugin, CavaPlugin *c) {
     hbox = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 8);
     GtkWidget *vbox3 = gtk_box_new(GTK_ORIENTATION_VERTICAL, 8);
     gtk_container_set_border_width(GTK_CONTAINER(vbox3), 8);
-    create_check_button(c, hbox, NULL, UPDATE_NONE, "Enable", &s->equalizer);
+    create_check_button(c, hbox, NULL, UPDATE_EQUALIZER, "Enable", &s->equalizer);
     create_reset_button(c, hbox, "Reset", reset_equalizer_button);
     gtk_box_pack_start(GTK_BOX(vbox3), GTK_WIDGET(hbox), FALSE, FALSE, 0);
     hbox = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 0);
@@ -461,11 +607,20 @@ void plugin_configure (XfcePanelPlugin *plugin, CavaPlugin *c) {
     for (int i = 0; i < EQUALIZER_KEY_COUNT; i++) {
         freq = logspace(s->lower_cutoff_freq, s->higher_cutoff_freq, i, 
                 EQUALIZER_KEY_COUNT);
-        c->equalizer_scales[i] = create_scale(c, hbox, sg, UPDATE_NONE, NULL, 
+        c->equalizer_scales[i] = create_scale(c, hbox, sg, UPDATE_EQUALIZER, NULL, 
                 &s->equalizer_keys[i], 0.0, EQUALIZER_MAX, 0.1);
     }
     gtk_box_pack_start(GTK_BOX(vbox3), GTK_WIDGET(hbox), TRUE, TRUE, 0);
 
+    // Statistics
+    GtkWidget *vbox4 = gtk_box_new(GTK_ORIENTATION_VERTICAL, 8);
+    gtk_container_set_border_width(GTK_CONTAINER(vbox4), 8);
+    hbox = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 8);
+    create_check_button(c, hbox, NULL, UPDATE_STATS, "Enable", &s->statistics);
+    create_reset_button(c, hbox, "Reset", reset_stats_button);
+    gtk_box_pack_start(GTK_BOX(vbox4), GTK_WIDGET(hbox), FALSE, FALSE, 0);
+    create_stats_page(c, vbox4);
+
     // Tab Pages
     GtkWidget* notebook = gtk_notebook_new();
 
@@ -476,6 +631,8 @@ void plugin_configure (XfcePanelPlugin *plugin, CavaPlugin *c) {
             GTK_WIDGET(vbox2), gtk_label_new("Colors"));
     gtk_notebook_append_page(GTK_NOTEBOOK(notebook), 
             GTK_WIDGET(vbox3), gtk_label_new("Equalizer"));
+    gtk_notebook_append_page(GTK_NOTEBOOK(notebook), 
+            GTK_WIDGET(vbox4), gtk_label_new("Statistics"));
     gtk_widget_set_vexpand(vbox3, TRUE);
 
     GtkWidget *content = gtk_dialog_get_content_area(GTK_DIALOG(dialog));
@@ -0,0 +1,170 @@
+#include <math.h>
+#include <stdlib.h>
+
+#include "cava/util.h"
+#include "filters.h"
+
+int filter_scratch_init(FilterScratch *f, int bars) {
+    f->decay = (double *)malloc(bars * sizeof(double));
+    f->decay_base = 0.0;
+    f->envelope_pos = (int *)malloc(bars * sizeof(int));
+    f->envelope_height = (double *)malloc(bars * sizeof(double));
+    f->envelope_start = (double *)malloc(bars * sizeof(double));
+    f->bars = bars;
+    if (f->decay == NULL || f->envelope_pos == NULL ||
+            f->envelope_height == NULL || f->envelope_start == NULL) {
+        filter_scratch_free(f);
+        return -1;
+    }
+    return 0;
+}
+
+void filter_scratch_free(FilterScratch *f) {
+    free(f->decay);
+    free(f->envelope_pos);
+    free(f->envelope_height);
+    free(f->envelope_start);
+    f->decay = NULL;
+    f->envelope_pos = NULL;
+    f->envelope_height = NULL;
+    f->envelope_start = NULL;
+}
+
+// Returns a table of pow(base, de) for de = 0..f->bars-1. The table is kept
+// between frames and only refilled when the smoothing changes.
+static double *decay_table(FilterScratch *f, double base) {
+    if (f->decay_base != base) {
+        for (int de = 0; de < f->bars; de++)
+            f->decay[de] = pow(base, de);
+        f->decay_base = base;
+    }
+    return f->decay;
+}
+
+// Linear-time equivalent of spreading every bar to every other bar with
+// _bars[z] / pow(base, de). Bars are processed from left to right, so a bar
+// raised by its left neighbours spreads that raised value further right: the
+// forward pass reproduces this by carrying the bar whose decayed value is the
+// largest so far. The backward pass does the same from the right, but only
+// spreads the values left by the forward pass.
+static void monstercat_spread(FilterScratch *f, float *_bars,
+        int _number_of_bars, double base) {
+    double *decay = decay_table(f, base);
+    int c = -1;
+    for (int m = 0; m < _number_of_bars; m++) {
+        if (c >= 0) {
+            _bars[m] = max(_bars[c] / decay[m - c], _bars[m]);
+            if (_bars[m] >= _bars[c] / decay[m - c])
+                c = m;
+        }
+        else {
+            c = m;
+        }
+    }
+    float spread = 0.0;
+    c = -1;
+    for (int m = _number_of_bars - 1; m >= 0; m--) {
+        // spread the forward-pass value, not the one raised below
+        float source = _bars[m];
+        if (c >= 0)
+            _bars[m] = max(spread / decay[c - m], _bars[m]);
+        if (c < 0 || source >= spread / decay[c - m]) {
+            c = m;
+            spread = source;
+        }
+    }
+}
+
+// Upper envelope of the parabolas height - curve * (x - pos)^2, used by the
+// waves filter. Parabolas are pushed in order of increasing pos and the
+// envelope is queried at increasing x, which keeps both operations amortized
+// constant time (Felzenszwalb & Huttenlocher, "Distance Transforms of Sampled
+// Functions").
+typedef struct {
+    int *pos;       // vertex position of each parabola on the envelope
+    double *height; // vertex height of each parabola on the envelope
+    double *start;  // x from which each parabola is the highest one
+    int count;
+    int query;      // parabola that was highest at the last queried x
+    double curve;
+} Envelope;
+
+static void envelope_reset(Envelope *e, FilterScratch *f, double curve) {
+    e->pos = f->envelope_pos;
+    e->height = f->envelope_height;
+    e->start = f->envelope_start;
+    e->count = 0;
+    e->query = 0;
+    e->curve = curve;
+}
+
+static void envelope_push(Envelope *e, int pos, double height) {
+    double x = -INFINITY;
+    while (e->count > 0) {
+        int k = e->count - 1;
+        // where the new parabola rises above parabola k
+        x = ((e->height[k] - height) / (e->curve * (pos - e->pos[k])) +
+                e->pos[k] + pos) / 2.0;
+        if (x > e->start[k])
+            break;
+        e->count--;
+        x = -INFINITY;
+    }
+    e->pos[e->count] = pos;
+    e->height[e->count] = height;
+    e->start[e->count] = x;
+    e->count++;
+    if (e->query >= e->count)
+        e->query = e->count - 1;
+}
+
+// Returns the highest parabola's value at x, which must not be lower than the
+// x of the previous query.
+static double envelope_query(Envelope *e, int x) {
+    while (e->query + 1 < e->count && e->start[e->query + 1] <= x)
+        e->query++;
+    double de = x - e->pos[e->query];
+    return e->height[e->query] - e->curve * (de * de);
+}
+
+// Linear-time equivalent of spreading every bar to every other bar with
+// _bars[z] - height_normalizer * de^2, each bar being divided by 1.25 right
+// before it spreads. As with monstercat_spread(), values raised from the left
+// are spread further right, while the backward pass only spreads the values
+// left by the forward pass.
+static void waves_spread(FilterScratch *f, float *_bars, int _number_of_bars,
+        float height_normalizer) {
+    Envelope e;
+    envelope_reset(&e, f, height_normalizer);
+    for (int m = 0; m < _number_of_bars; m++) {
+        if (e.count > 0)
+            _bars[m] = max(envelope_query(&e, m), _bars[m]);
+        _bars[m] = _bars[m] / 1.25;
+        envelope_push(&e, m, _bars[m]);
+    }
+    // mirror the positions so they keep increasing from right to left
+    envelope_reset(&e, f, height_normalizer);
+    for (int m = _number_of_bars - 1; m >= 0; m--) {
+        float source = _bars[m];
+        if (e.count > 0)
+            _bars[m] = max(envelope_query(&e, _number_of_bars - 1 - m),
+                    _bars[m]);
+        envelope_push(&e, _number_of_bars - 1 - m, source);
+    }
+}
+
+float *monstercat_filter(FilterScratch *f, float *_bars, int _number_of_bars,
+        int waves, double monstercat, int height) {
+    float height_normalizer = 1.0;
+    monstercat = (100.0 - (monstercat / 3.0)) / 100.0;
+    if (height > 1000) {
+        height_normalizer = height / 912.76;
+    }
+    if (waves > 0) {
+        waves_spread(f, _bars, _number_of_bars, height_normalizer);
+    }
+    else if (monstercat > 0) {
+        monstercat_spread(f, _bars, _number_of_bars, monstercat * 1.5);
+    }
+    return _bars;
+}
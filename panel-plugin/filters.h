@@ -0,0 +1,26 @@
+#ifndef __FILTERS_H__
+#define __FILTERS_H__
+
+// Scratch space of the smoothing filters for up to bars bars at a time. Each
+// CavaState has its own, so that plugin instances and the state being built
+// on a worker thread never share it.
+typedef struct {
+    double *decay; // pow(decay_base, de) for de = 0..bars-1
+    double decay_base; // 0 until the table is first filled
+    // parabolas on the upper envelope of the waves filter
+    int *envelope_pos;
+    double *envelope_height;
+    double *envelope_start;
+    int bars;
+} FilterScratch;
+
+// Returns 0, or -1 if the scratch space could not be allocated.
+int filter_scratch_init(FilterScratch *f, int bars);
+void filter_scratch_free(FilterScratch *f);
+
+// Spreads each of the _number_of_bars bars, at most the bars f was
+// initialized for, onto the others.
+float *monstercat_filter(FilterScratch *f, float *_bars, int _number_of_bars,
+        int waves, double monstercat, int height);
+
+#endif /* !__FILTERS_H__ */
@@ -29,6 +29,7 @@
 
 #include "plugin.h"
 #include "dialogs.h"
+#include "cava/cavacore.h"
 
 /* default settings */
 const gint default_framerate = 60;
@@ -41,6 +42,11 @@ const gint default_bar_spacing = 1;
 const gint default_max_height = 100;
 const gint default_lower_cutoff_freq = 50;
 const gint default_higher_cutoff_freq = 10000;
+const gint default_window = CAVA_WINDOW_HANN;
+const gint default_overlap = 0;
+const gint default_engine = CAVA_ENGINE_FFT;
+const gint default_high_density = 0;
+const gint default_workers = 0;
 const gint default_sleep_timer = 1;
 const gint default_method = INPUT_PIPEWIRE; //INPUT_PULSE;
 gchar *default_source = "auto";
@@ -54,9 +60,12 @@ const gint default_virtual = 1;
 const gint default_orientation = ORIENT_BOTTOM;
 const gint default_stereo = 1;
 const gint default_mono_option = AVERAGE;
+const gint default_layout = LAYOUT_GROUPED;
+const gint default_downmix = 0;
 const gint default_reverse = 0;
 const gint default_show_idle_bar_heads = 0;
 const gint default_waveform = 0;
+const gint default_statistics = 0;
 gchar *default_background = "#00000000";
 gchar *default_foreground = "#3fffff";
 const gint default_gradient = 0;
@@ -137,6 +146,11 @@ void plugin_save(XfcePanelPlugin *plugin, CavaPlugin *c) {
         xfce_rc_write_int_entry(rc, "max_height", s->max_height);
         xfce_rc_write_int_entry(rc, "lower_cutoff_freq", s->lower_cutoff_freq);
         xfce_rc_write_int_entry(rc, "higher_cutoff_freq", s->higher_cutoff_freq);
+        xfce_rc_write_int_entry(rc, "window", s->window);
+        xfce_rc_write_int_entry(rc, "overlap", s->overlap);
+        xfce_rc_write_int_entry(rc, "engine", s->engine);
+        xfce_rc_write_int_entry(rc, "high_density", s->high_density);
+        xfce_rc_write_int_entry(rc, "workers", s->workers);
         xfce_rc_write_int_entry(rc, "sleep_timer", s->sleep_timer);
         xfce_rc_write_int_entry(rc, "method", s->method);
         xfce_rc_write_entry(rc, "source", s->source);
@@ -150,9 +164,12 @@ void plugin_save(XfcePanelPlugin *plugin, CavaPlugin *c) {
         xfce_rc_write_int_entry(rc, "orientation", s->orientation);
         xfce_rc_write_int_entry(rc, "stereo", s->stereo);
         xfce_rc_write_int_entry(rc, "mono_option", s->mono_option);
+        xfce_rc_write_int_entry(rc, "layout", s->layout);
+        xfce_rc_write_int_entry(rc, "downmix", s->downmix);
         xfce_rc_write_int_entry(rc, "reverse", s->reverse);
         xfce_rc_write_int_entry(rc, "show_idle_bar_heads", s->show_idle_bar_heads);
         xfce_rc_write_int_entry(rc, "waveform", s->waveform);
+        xfce_rc_write_int_entry(rc, "statistics", s->statistics);
         xfce_rc_write_entry(rc, "background", s->background);
         xfce_rc_write_entry(rc, "foreground", s->foreground);
         xfce_rc_write_int_entry(rc, "gradient", s->gradient);
@@ -222,6 +239,11 @@ static void plugin_read(CavaPlugin *c) {
             s->max_height = xfce_rc_read_int_entry(rc, "max_height", default_max_height);
             s->lower_cutoff_freq = xfce_rc_read_int_entry(rc, "lower_cutoff_freq", default_lower_cutoff_freq);
             s->higher_cutoff_freq = xfce_rc_read_int_entry(rc, "higher_cutoff_freq", default_higher_cutoff_freq);
+            s->window = xfce_rc_read_int_entry(rc, "window", default_window);
+            s->overlap = xfce_rc_read_int_entry(rc, "overlap", default_overlap);
+            s->engine = xfce_rc_read_int_entry(rc, "engine", default_engine);
+            s->high_density = xfce_rc_read_int_entry(rc, "high_density", default_high_density);
+            s->workers = xfce_rc_read_int_entry(rc, "workers", default_workers);
             s->sleep_timer = xfce_rc_read_int_entry(rc, "sleep_timer", default_sleep_timer);
             s->method = xfce_rc_read_int_entry(rc, "method", default_method);
             s->source = g_strdup(xfce_rc_read_entry(rc, "source", default_source));
@@ -235,9 +257,12 @@ static void plugin_read(CavaPlugin *c) {
             s->orientation = xfce_rc_read_int_entry(rc, "orientation", default_orientation);
             s->stereo = xfce_rc_read_int_entry(rc, "stereo", default_stereo);
             s->mono_option = xfce_rc_read_int_entry(rc, "mono_option", default_mono_option);
+            s->layout = xfce_rc_read_int_entry(rc, "layout", default_layout);
+            s->downmix = xfce_rc_read_int_entry(rc, "downmix", default_downmix);
             s->reverse = xfce_rc_read_int_entry(rc, "reverse", default_reverse);
             s->show_idle_bar_heads = xfce_rc_read_int_entry(rc, "show_idle_bar_heads", default_show_idle_bar_heads);
             s->waveform = xfce_rc_read_int_entry(rc, "waveform", default_waveform);
+            s->statistics = xfce_rc_read_int_entry(rc, "statistics", default_statistics);
             s->background = g_strdup(xfce_rc_read_entry(rc, "background", default_background));
             s->foreground = g_strdup(xfce_rc_read_entry(rc, "foreground", default_foreground));
             s->gradient = xfce_rc_read_int_entry(rc, "gradient", default_gradient);
@@ -291,6 +316,11 @@ static void plugin_read(CavaPlugin *c) {
     s->max_height = default_max_height;
     s->lower_cutoff_freq = default_lower_cutoff_freq;
     s->higher_cutoff_freq = default_higher_cutoff_freq;
+    s->window = default_window;
+    s->overlap = default_overlap;
+    s->engine = default_engine;
+    s->high_density = default_high_density;
+    s->workers = default_workers;
     s->max_height = default_max_height;
     s->sleep_timer = default_sleep_timer;
     s->method = default_method;
@@ -305,9 +335,12 @@ static void plugin_read(CavaPlugin *c) {
     s->orientation = default_orientation;
     s->stereo = default_stereo;
     s->mono_option = default_mono_option;
+    s->layout = default_layout;
+    s->downmix = default_downmix;
     s->reverse = default_reverse;
     s->show_idle_bar_heads = default_show_idle_bar_heads;
     s->waveform = default_waveform;
+    s->statistics = default_statistics;
     s->background = g_strdup(default_background);
     s->foreground = g_strdup(default_foreground);
     s->gradient = default_gradient;
@@ -387,6 +420,10 @@ static void plugin_free(XfcePanelPlugin *plugin, CavaPlugin *c) {
     if (G_UNLIKELY(dialog != NULL))
         gtk_widget_destroy(dialog);
 
+    /* stop the visualization before its widgets go away */
+    if (c->initialized)
+        free_cava(c);
+
     /* destroy the panel widgets */
     gtk_widget_destroy(c->hvbox);
 
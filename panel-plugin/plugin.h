@@ -22,6 +22,7 @@
 
 #include <libxfce4panel/libxfce4panel.h>
 #include "cava/input/common.h"
+#include "stats.h"
 
 G_BEGIN_DECLS
 
@@ -51,6 +52,11 @@ enum output_method {
 
 enum mono_option { LEFT, RIGHT, AVERAGE };
 
+// how the spectra of more than one channel are shown: grouped into a left
+// and a right side, which stereo mirrors and mono_option picks from, or one
+// after the other
+enum channel_layout { LAYOUT_GROUPED, LAYOUT_SEPARATE };
+
 enum xaxis_scale { NONE, FREQUENCY, NOTE };
 
 enum orientation {
@@ -77,6 +83,11 @@ typedef struct {
     gint max_height;
     gint lower_cutoff_freq;
     gint higher_cutoff_freq;
+    gint window;
+    gint overlap;
+    gint engine;
+    gint high_density;
+    gint workers;
     gint sleep_timer;
     /* input */
     gint method;
@@ -92,9 +103,12 @@ typedef struct {
     gint orientation;
     gint stereo;
     gint mono_option;
+    gint layout;
+    gint downmix;
     gint reverse;
     gint show_idle_bar_heads;
     gint waveform;
+    gint statistics;
     /* color */
     gchar *background;
     gchar *foreground;
@@ -119,6 +133,8 @@ typedef struct {
     gchar *css;
 } CavaSettings;
 
+typedef struct CavaState CavaState;
+
 /* plugin structure */
 typedef struct
 {
@@ -136,9 +152,14 @@ typedef struct
     GtkCssProvider  *css;
 
     /* cava */
-    struct cava_plan *plan;
+    CavaState       *state;
+    GThread         *builder; // returns the CavaBuild once built is set
+    gint            built;
+    gboolean        rebuild_pending;
+    guint           rebuild_id;
+    guint           timeout_id;
     struct audio_data audio;
-    cairo_pattern_t *foreground;
+    CavaStats       *stats; // NULL unless the statistics setting is on
 
     /* cava data */
     gboolean initialized;
@@ -146,8 +167,11 @@ typedef struct
 CavaPlugin;
 
 void init_cava(CavaPlugin *cava);
-void config_cava(CavaPlugin *cava);
+void rebuild_cava(CavaPlugin *cava);
+void config_plan(CavaPlugin *cava);
 void free_cava(CavaPlugin *cava);
+void config_equalizer(CavaPlugin *cava);
+void config_stats(CavaPlugin *cava);
 void resize_display(CavaPlugin *cava);
 void restyle_display(CavaPlugin *cava);
 void config_colors(CavaPlugin *cava);
@@ -0,0 +1,92 @@
+#include <string.h>
+#include <time.h>
+
+#include "stats.h"
+
+static const char *stage_names[STATS_STAGE_COUNT] = {
+    "Capture",
+    "Hand-off",
+    "Window",
+    "FFT",
+    "Bands",
+    "Smoothing",
+    "Post-processing",
+    "Drawing",
+};
+
+uint64_t stats_now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+// Bucket of a time, the octave of ns and the two bits below its highest.
+static int bucket(uint64_t ns) {
+    if (ns < 4)
+        return ns;
+    int octave = 63 - __builtin_clzll(ns);
+    int b = octave * 4 + ((ns >> (octave - 2)) & 3) - 4;
+    return b < STATS_BUCKETS ? b : STATS_BUCKETS - 1;
+}
+
+// The smallest time of the bucket after b, which the times in b are below.
+static uint64_t bucket_end(int b) {
+    if (b + 1 < 4)
+        return b + 1;
+    int octave = (b + 1 + 4) / 4;
+    return (uint64_t)(4 + (b + 1 + 4) % 4) << (octave - 2);
+}
+
+void stats_record(CavaStats *stats, enum stats_stage stage, uint64_t ns) {
+    StatsHistogram *h = &stats->stages[stage];
+    if (h->count == 0 || ns < h->min_ns)
+        h->min_ns = ns;
+    if (ns > h->max_ns)
+        h->max_ns = ns;
+    h->count++;
+    h->total_ns += ns;
+    h->buckets[bucket(ns)]++;
+}
+
+void stats_record_since(CavaStats *stats, enum stats_stage stage,
+        uint64_t start) {
+    stats_record(stats, stage, stats_now() - start);
+}
+
+// Counts a frame, and the frames before it that the timeout of framerate
+// did not run for, when it came more than half a frame late.
+void stats_frame(CavaStats *stats, int framerate) {
+    uint64_t now = stats_now();
+    uint64_t period = 1000000000 / framerate;
+    if (stats->last_frame_ns && now - stats->last_frame_ns > period * 3 / 2)
+        stats->skipped_frames += (now - stats->last_frame_ns + period / 2) /
+            period - 1;
+    stats->last_frame_ns = now;
+    stats->frames++;
+}
+
+void stats_reset(CavaStats *stats) {
+    memset(stats, 0, sizeof(CavaStats));
+}
+
+const char *stats_stage_name(enum stats_stage stage) {
+    return stage_names[stage];
+}
+
+// The time a fraction of the ones recorded stay below, rounded up to the
+// end of its bucket but no further than the longest.
+uint64_t stats_percentile(const StatsHistogram *h, double fraction) {
+    // the rank of the time, counted from 1
+    uint64_t rank = h->count * fraction;
+    if (rank < h->count * fraction || rank == 0)
+        rank++;
+    uint64_t seen = 0;
+    for (int b = 0; b < STATS_BUCKETS; b++) {
+        seen += h->buckets[b];
+        if (seen >= rank) {
+            uint64_t end = bucket_end(b);
+            return end < h->max_ns ? end : h->max_ns;
+        }
+    }
+    return h->max_ns;
+}
@@ -0,0 +1,53 @@
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <stdint.h>
+
+// Where the time of a frame goes, in the order the samples pass through.
+// The capture stages are recorded by the audio thread with the audio lock
+// held, the others on the GTK thread, so the lock is all it takes to read
+// them all.
+enum stats_stage {
+    STATS_CAPTURE, // writing a buffer of samples into cava_in or the plan
+    STATS_HANDOFF, // from the first samples after a frame to the next frame
+    STATS_WINDOW, // the stages of cava_execute, see enum cava_stage
+    STATS_FFT,
+    STATS_BANDS,
+    STATS_SMOOTHING,
+    STATS_POST, // scaling, filtering and remixing the bars in exec_cava
+    STATS_DRAW, // draw_cava
+    STATS_STAGE_COUNT
+};
+
+// Buckets of a histogram, a quarter of an octave of nanoseconds each, which
+// reaches above 4 seconds. The percentiles are within a bucket, 19%.
+#define STATS_BUCKETS 128
+
+typedef struct {
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t min_ns;
+    uint64_t max_ns;
+    uint32_t buckets[STATS_BUCKETS];
+} StatsHistogram;
+
+typedef struct CavaStats {
+    StatsHistogram stages[STATS_STAGE_COUNT];
+    uint64_t dropped_samples; // discarded when cava_in overflowed
+    uint64_t frames; // runs of exec_cava
+    uint64_t skipped_frames; // frames the timeout was too late for
+    uint64_t repaints; // runs of draw_cava
+    uint64_t last_frame_ns;
+    uint64_t handoff_ns; // when the samples of the next frame started
+} CavaStats;
+
+uint64_t stats_now(void);
+void stats_record(CavaStats *stats, enum stats_stage stage, uint64_t ns);
+void stats_record_since(CavaStats *stats, enum stats_stage stage,
+        uint64_t start);
+void stats_frame(CavaStats *stats, int framerate);
+void stats_reset(CavaStats *stats);
+const char *stats_stage_name(enum stats_stage stage);
+uint64_t stats_percentile(const StatsHistogram *h, double fraction);
+
+#endif /* !__STATS_H__ */
@@ -0,0 +1,65 @@
+// Times the FFT backend cavacore is built with at the sizes cavacore runs: 512
+// to 32768 points for the mid and treble, and up to 65536 for the padded bass
+// of high density mode. Building it once with each value of the fft option
+// compares the backends.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "fft/fft.h"
+
+// how long each FFT is run for, in seconds
+#define RUN_TIME 0.2
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// microseconds per run of the FFT of in into out
+static double time_fft(const struct cava_fft *fft, double *in,
+        cava_complex *out) {
+    long runs = 0;
+    double start = now(), elapsed;
+    do {
+        for (int i = 0; i < 16; i++)
+            cava_fft_execute(fft, in, out);
+        runs += 16;
+        elapsed = now() - start;
+    } while (elapsed < RUN_TIME);
+    return elapsed / runs * 1e6;
+}
+
+int main(void) {
+    printf("backend %s\n", cava_fft_backend);
+    printf("%8s %14s %14s\n", "size", "plan", "run");
+    for (int size = 512; size <= 65536; size *= 2) {
+        double *in = NULL;
+        cava_complex *out = NULL;
+        if (posix_memalign((void **)&in, 64, size * sizeof(double)) != 0 ||
+                posix_memalign((void **)&out, 64,
+                    (size / 2 + 1) * sizeof(cava_complex)) != 0) {
+            fprintf(stderr, "could not allocate %d points\n", size);
+            return EXIT_FAILURE;
+        }
+        for (int n = 0; n < size; n++)
+            in[n] = (double)rand() / RAND_MAX - 0.5;
+
+        double start = now();
+        struct cava_fft *fft = cava_fft_plan(size);
+        double plan = now() - start;
+        if (fft == NULL) {
+            fprintf(stderr, "could not plan %d points\n", size);
+            return EXIT_FAILURE;
+        }
+        double run = time_fft(fft, in, out);
+        printf("%8d %11.1f ms %11.2f us\n", size, plan * 1e3, run);
+
+        cava_fft_destroy(fft);
+        free(in);
+        free(out);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,677 @@
+// Checks the paths cavacore takes to save work against the plain ones they
+// stand in for. Each test is run by its name, given as the only argument.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cavacore.h"
+#include "util.h"
+
+// frames written per execution
+#define BLOCK 512
+
+// enough for the most bars of any test on every channel
+#define MAX_OUT 4096
+
+// a plan for options, or NULL after reporting why there is none
+static struct cava_plan *plan_for(const struct cava_options *options) {
+    struct cava_plan *p = cava_init_with_options(options);
+    if (p->status != 0) {
+        fprintf(stderr, "cava_init: %s\n", p->error_message);
+        cava_destroy(p);
+        return NULL;
+    }
+    return p;
+}
+
+// the next frames of a stream, a few tones per channel over noise, in whole
+// steps of 16 bit audio so that both history formats hold them exactly. t
+// counts the frames written so far
+static void next_frames(double *in, int frames, int channels, long *t) {
+    for (int f = 0; f < frames; f++, (*t)++) {
+        for (int c = 0; c < channels; c++) {
+            double s = 6000 * sin(*t * 0.013 * (c + 1)) +
+                2000 * sin(*t * 0.21 + c) + 500 * sin(*t * 1.7) +
+                (rand() % 801 - 400);
+            in[f * channels + c] = rint(s);
+        }
+    }
+}
+
+// 1 if the first count values of out and expected differ, after reporting
+// the first that does
+static int differs(const char *test, const char *what, const double *expected,
+        const double *out, int count) {
+    for (int n = 0; n < count; n++) {
+        if (out[n] != expected[n]) {
+            fprintf(stderr, "%s: %s: bar %d is %.17g instead of %.17g\n",
+                    test, what, n, out[n], expected[n]);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// a reconfigured plan carries on exactly like a new plan with the new options
+// that inherited the old one, which is what it replaces
+static int test_reconfigure(void) {
+    static const struct cava_options changes[] = {
+        { .number_of_bars = 24, .rate = 44100, .autosens = 1,
+            .noise_reduction = 0.5, .low_cut_off = 100, .high_cut_off = 8000 },
+        { .number_of_bars = 40, .rate = 44100, .autosens = 1,
+            .noise_reduction = 0.77, .low_cut_off = 50, .high_cut_off = 10000 },
+        { .number_of_bars = 24, .rate = 44100, .autosens = 1,
+            .noise_reduction = 0.77, .low_cut_off = 50, .high_cut_off = 10000,
+            .window = CAVA_WINDOW_BLACKMAN_HARRIS, .overlap = 50 },
+        { .number_of_bars = 200, .rate = 44100, .autosens = 0,
+            .noise_reduction = 0, .low_cut_off = 50, .high_cut_off = 10000,
+            .high_density = 1 },
+        { .number_of_bars = 24, .rate = 44100, .autosens = 1,
+            .noise_reduction = 0.77, .low_cut_off = 50, .high_cut_off = 10000,
+            .engine = CAVA_ENGINE_BIQUAD },
+        { .number_of_bars = 24, .rate = 48000, .autosens = 1,
+            .noise_reduction = 0.77, .low_cut_off = 50, .high_cut_off = 10000 },
+    };
+    static double in[BLOCK * 2], out[MAX_OUT], expected[MAX_OUT];
+    int failures = 0;
+    for (int format = 0; format < 2; format++) {
+        for (int channels = 1; channels <= 2; channels++) {
+            for (size_t k = 0; k < ARRAY_SIZE(changes); k++) {
+                struct cava_options from = {
+                    .number_of_bars = 24, .rate = 44100, .channels = channels,
+                    .autosens = 1, .noise_reduction = 0.77, .low_cut_off = 50,
+                    .high_cut_off = 10000, .history_format = format,
+                };
+                struct cava_options to = changes[k];
+                to.channels = channels;
+                to.history_format = format;
+
+                struct cava_plan *a = plan_for(&from), *twin = plan_for(&from);
+                if (a == NULL || twin == NULL)
+                    return 1;
+                long t = 0;
+                for (int e = 0; e < 100; e++) {
+                    next_frames(in, BLOCK, channels, &t);
+                    cava_execute(in, BLOCK * channels, out, a);
+                    cava_execute(in, BLOCK * channels, expected, twin);
+                }
+
+                a = cava_reconfigure(a, &to);
+                struct cava_plan *b = plan_for(&to);
+                if (a->status != 0 || b == NULL) {
+                    fprintf(stderr, "reconfigure: %s\n", a->error_message);
+                    return 1;
+                }
+                cava_inherit(b, twin);
+                cava_destroy(twin);
+
+                char what[64];
+                snprintf(what, sizeof(what), "change %zu, format %d, "
+                        "%d channels", k, format, channels);
+                for (int e = 0; e < 100; e++) {
+                    next_frames(in, BLOCK, channels, &t);
+                    cava_execute(in, BLOCK * channels, out, a);
+                    cava_execute(in, BLOCK * channels, expected, b);
+                    if (differs("reconfigure", what, expected, out,
+                            to.number_of_bars * channels)) {
+                        failures++;
+                        break;
+                    }
+                }
+                cava_destroy(a);
+                cava_destroy(b);
+            }
+        }
+    }
+
+    // illegal options give a plan with an error, like cava_init
+    struct cava_options from = { .number_of_bars = 24, .rate = 44100,
+        .channels = 2, .autosens = 1, .noise_reduction = 0.77,
+        .low_cut_off = 50, .high_cut_off = 10000 };
+    struct cava_options to = from;
+    to.low_cut_off = 500;
+    to.high_cut_off = 100;
+    struct cava_plan *a = plan_for(&from);
+    if (a == NULL)
+        return 1;
+    a = cava_reconfigure(a, &to);
+    if (a->status != -1) {
+        fprintf(stderr, "reconfigure: illegal options were taken\n");
+        failures++;
+    }
+    cava_destroy(a);
+    return failures;
+}
+
+// a plan that inherited another one with the same options carries on
+// exactly like it, and one with another rate is left as it is
+static int test_inherit(void) {
+    static double in[BLOCK * 2], out[MAX_OUT], expected[MAX_OUT];
+    int failures = 0;
+    for (int format = 0; format < 2; format++) {
+        for (int channels = 1; channels <= 2; channels++) {
+            struct cava_options options = {
+                .number_of_bars = 24, .rate = 44100, .channels = channels,
+                .autosens = 1, .noise_reduction = 0.77, .low_cut_off = 50,
+                .high_cut_off = 10000, .history_format = format,
+            };
+            struct cava_options other = options;
+            other.rate = 48000;
+            struct cava_plan *a = plan_for(&options);
+            struct cava_plan *b = plan_for(&options);
+            struct cava_plan *c = plan_for(&other);
+            struct cava_plan *d = plan_for(&other);
+            if (a == NULL || b == NULL || c == NULL || d == NULL)
+                return 1;
+            long t = 0;
+            for (int e = 0; e < 100; e++) {
+                next_frames(in, BLOCK, channels, &t);
+                cava_execute(in, BLOCK * channels, out, a);
+            }
+            cava_inherit(b, a);
+            cava_inherit(c, a);
+
+            char what[64];
+            snprintf(what, sizeof(what), "format %d, %d channels", format,
+                    channels);
+            for (int e = 0; e < 100; e++) {
+                next_frames(in, BLOCK, channels, &t);
+                cava_execute(in, BLOCK * channels, expected, a);
+                cava_execute(in, BLOCK * channels, out, b);
+                if (differs("inherit", what, expected, out,
+                        options.number_of_bars * channels)) {
+                    failures++;
+                    break;
+                }
+            }
+            for (int e = 0; e < 100; e++) {
+                next_frames(in, BLOCK, channels, &t);
+                cava_execute(in, BLOCK * channels, expected, d);
+                cava_execute(in, BLOCK * channels, out, c);
+                if (differs("inherit another rate", what, expected, out,
+                        options.number_of_bars * channels)) {
+                    failures++;
+                    break;
+                }
+            }
+            cava_destroy(a);
+            cava_destroy(b);
+            cava_destroy(c);
+            cava_destroy(d);
+        }
+    }
+    return failures;
+}
+
+// steady tones for the bass test, at bins of the bass FFT, and their
+// amplitudes in steps of 16 bit audio: two in the bass, one in the mids, and
+// one at the bass rate minus its bin, which the decimation of the bass folds
+// onto that bin unless it is filtered out. on their bins a Hann window only
+// leaks them into the bins next to them
+#define BASS_TONES 4
+static const double bass_tones[BASS_TONES][2] = {
+    { 7, 8000 }, { 14, 4000 }, { 190, 6000 }, { 11, 8000 },
+};
+
+// the tones at t seconds, with bins of analysis_rate / size Hz
+static double bass_signal(double t, int analysis_rate, int size) {
+    double s = 0;
+    for (int i = 0; i < BASS_TONES; i++) {
+        double f = bass_tones[i][0] * analysis_rate / size;
+        if (i == BASS_TONES - 1)
+            f = analysis_rate / 8.0 - f;
+        s += bass_tones[i][1] * sin(2 * M_PI * f * t);
+    }
+    return s;
+}
+
+// the bass bars of a plan are the ones an FFT at the analysis rate over the
+// whole window of the bass history would give, an eighth of them as its
+// window sums up to 8 times as much. they only differ by what the half-band
+// filters let through of the band they fold over the bass
+static int test_bass(void) {
+    static const unsigned int rates[] = { 44100, 48000, 192000 };
+    static double in[BLOCK], out[MAX_OUT];
+    int failures = 0;
+    for (size_t r = 0; r < ARRAY_SIZE(rates); r++) {
+        struct cava_options options = {
+            .number_of_bars = 40, .rate = rates[r], .channels = 1,
+            .noise_reduction = 0.77, .low_cut_off = 30, .high_cut_off = 10000,
+        };
+        struct cava_plan *p = plan_for(&options);
+        if (p == NULL)
+            return 1;
+        int size = p->FFTbassbufferSize * 8;
+        int frames = 3 * size * p->decimation;
+        for (long t = 0; t < frames; t += BLOCK) {
+            for (int f = 0; f < BLOCK; f++)
+                in[f] = bass_signal((double)(t + f) / p->rate,
+                        p->analysis_rate, size);
+            cava_execute(in, BLOCK, out, p);
+        }
+
+        // the reference sees the tones at the analysis rate, the decimation
+        // of the input to it aside
+        double *window = malloc(size * sizeof(double));
+        if (window == NULL)
+            return 1;
+        for (int i = 0; i < size; i++)
+            window[i] = 0.5 * (1 - cos(2 * M_PI * i / (size - 1))) *
+                bass_signal((double)i / p->analysis_rate, p->analysis_rate,
+                        size);
+        int bars = p->bass_cut_off_bar;
+        double expected[MAX_OUT], largest = 0;
+        for (int n = 0; n < bars; n++) {
+            expected[n] = 0;
+            for (int k = p->FFTbuffer_lower_cut_off[n];
+                    k <= p->FFTbuffer_upper_cut_off[n]; k++) {
+                double re = 0, im = 0;
+                for (int i = 0; i < size; i++) {
+                    double a = 2 * M_PI * (double)((long)k * i % size) / size;
+                    re += window[i] * cos(a);
+                    im -= window[i] * sin(a);
+                }
+                expected[n] += hypot(re, im) / 8;
+            }
+            largest = fmax(largest, expected[n]);
+        }
+        free(window);
+
+        if (bars < 2) {
+            fprintf(stderr, "bass: %u Hz has %d bass bars\n", rates[r], bars);
+            failures++;
+        }
+        for (int n = 0; n < bars; n++) {
+            if (!(fabs(p->cava_bands[n] - expected[n]) < largest * 0.01)) {
+                fprintf(stderr, "bass: %u Hz: bar %d is %g instead of %g\n",
+                        rates[r], n, p->cava_bands[n], expected[n]);
+                failures++;
+                break;
+            }
+        }
+        cava_destroy(p);
+    }
+    return failures;
+}
+
+// the Goertzel filterbanks give the bars the FFTs they replace would, up to
+// rounding. a twin of each plan with their counts at 0 runs the FFTs
+static int test_goertzel(void) {
+    // few and narrow bars, so that one of the FFTs or both only feed a few
+    // bins, and one with both FFTs for comparison
+    static const struct {
+        int bars, low, high;
+        unsigned int rate;
+    } configs[] = {
+        { 1, 50, 70, 44100 }, { 2, 60, 140, 48000 }, { 3, 200, 260, 44100 },
+        { 4, 100, 200, 96000 }, { 2, 30, 60, 44100 }, { 8, 50, 10000, 44100 },
+    };
+    static double in[BLOCK * 2], out[MAX_OUT];
+    int failures = 0, filterbanks = 0;
+    for (size_t k = 0; k < ARRAY_SIZE(configs); k++) {
+        for (int channels = 1; channels <= 2; channels++) {
+            struct cava_options options = {
+                .number_of_bars = configs[k].bars, .rate = configs[k].rate,
+                .channels = channels, .noise_reduction = 0.77,
+                .low_cut_off = configs[k].low, .high_cut_off = configs[k].high,
+            };
+            struct cava_plan *a = plan_for(&options);
+            struct cava_plan *b = plan_for(&options);
+            if (a == NULL || b == NULL)
+                return 1;
+            filterbanks += (a->goertzel_bass_count > 0) +
+                (a->goertzel_count > 0);
+            b->goertzel_bass_count = 0;
+            b->goertzel_count = 0;
+
+            long t = 0;
+            double error = 0;
+            for (int e = 0; e < 100; e++) {
+                next_frames(in, BLOCK, channels, &t);
+                cava_execute(in, BLOCK * channels, out, a);
+                cava_execute(in, BLOCK * channels, out, b);
+                for (int n = 0; n < configs[k].bars * channels; n++) {
+                    double d = fabs(a->cava_bands[n] - b->cava_bands[n]);
+                    error = fmax(error, d / fmax(b->cava_bands[n], 1e-9));
+                }
+            }
+            if (!(error < 1e-9)) {
+                fprintf(stderr, "goertzel: %d bars from %d to %d Hz at %u Hz, "
+                        "%d channels: off by %g\n", configs[k].bars,
+                        configs[k].low, configs[k].high, configs[k].rate,
+                        channels, error);
+                failures++;
+            }
+            cava_destroy(a);
+            cava_destroy(b);
+        }
+    }
+    if (filterbanks == 0) {
+        fprintf(stderr, "goertzel: no FFT was replaced\n");
+        failures++;
+    }
+    return failures;
+}
+
+// the magnitudes of bins up to last of the DFT of size points of in, which
+// is zero past its length points, into magnitudes
+static void dft_magnitudes(const double *in, int length, int size, int last,
+        double *magnitudes) {
+    double *c = malloc(size * sizeof(double));
+    double *s = malloc(size * sizeof(double));
+    for (int i = 0; i < size; i++) {
+        c[i] = cos(2 * M_PI * i / size);
+        s[i] = sin(2 * M_PI * i / size);
+    }
+    for (int k = 0; k <= last; k++) {
+        double re = 0, im = 0;
+        for (int i = 0; i < length; i++) {
+            int a = (int)((long)k * i % size);
+            re += in[i] * c[a];
+            im -= in[i] * s[a];
+        }
+        magnitudes[k] = hypot(re, im);
+    }
+    free(c);
+    free(s);
+}
+
+// the mean of the magnitudes interpolated linearly between the bins over a to
+// b bins, or the interpolated magnitude at a if that is no range at all
+static double dense_mean(const double *magnitudes, double a, double b) {
+    if (b - a < 1e-9) {
+        int i = floor(a);
+        return magnitudes[i] + (magnitudes[i + 1] - magnitudes[i]) * (a - i);
+    }
+    double sum = 0;
+    for (int i = floor(a); i < b; i++) {
+        double from = fmax(a, i), to = fmin(b, i + 1);
+        double slope = magnitudes[i + 1] - magnitudes[i];
+        sum += (to - from) * (magnitudes[i] + slope * ((from + to) / 2 - i));
+    }
+    return sum / (b - a);
+}
+
+// the bars of high density mode are the mean of the magnitudes of the DFT of
+// the zero padded window, interpolated linearly between its bins, over their
+// frequency range. with an overlap of 99 both FFTs run on every execution, so
+// the histories are what they ran on
+static int test_dense(void) {
+    static double in[BLOCK * 2], out[MAX_OUT];
+    int failures = 0;
+    for (int format = 0; format < 2; format++) {
+        for (int channels = 1; channels <= 2; channels++) {
+            struct cava_options options = {
+                .number_of_bars = 1500, .rate = 44100, .channels = channels,
+                .noise_reduction = 0.77, .low_cut_off = 30,
+                .high_cut_off = 16000,
+                .history_format = format, .overlap = 99, .high_density = 1,
+            };
+            struct cava_plan *p = plan_for(&options);
+            if (p == NULL)
+                return 1;
+            long t = 0;
+            for (int e = 0; e < 100; e++) {
+                next_frames(in, BLOCK, channels, &t);
+                cava_execute(in, BLOCK * channels, out, p);
+            }
+
+            int sizes[2] = { p->bass_fft_size, p->fft_size };
+            double *window = malloc(p->FFTbufferSize * sizeof(double));
+            double *magnitudes = malloc((p->fft_size / 2 + 1) * sizeof(double));
+            double expected[MAX_OUT], largest = 0;
+            for (int c = 0; c < channels; c++) {
+                for (int bass = 1; bass >= 0; bass--) {
+                    // the window over the ring of the history, oldest first
+                    int length = bass ? p->FFTbassbufferSize : p->FFTbufferSize;
+                    int pos = bass ? p->bass_pos : p->history_pos;
+                    const double *multiplier =
+                        bass ? p->bass_multiplier : p->multiplier;
+                    for (int i = 0; i < length; i++) {
+                        int j = c * length + (pos + i) % length;
+                        if (bass)
+                            window[i] = multiplier[i] * p->bass_history[j];
+                        else if (p->history_s16)
+                            window[i] = multiplier[i] * p->history_s16[j];
+                        else
+                            window[i] = multiplier[i] * p->input_buffer[j];
+                    }
+                    int size = sizes[!bass];
+                    double bin_width = (double)p->analysis_rate / size;
+                    if (bass)
+                        bin_width /= 8;
+                    dft_magnitudes(window, length, size, size / 2, magnitudes);
+
+                    int first = bass ? 0 : p->bass_cut_off_bar;
+                    int last = bass ? p->bass_cut_off_bar : p->number_of_bars;
+                    for (int n = first; n < last; n++) {
+                        double a = p->cut_off_frequency[n] / bin_width;
+                        double b = fmin(p->cut_off_frequency[n + 1] / bin_width,
+                                size / 2);
+                        double e = dense_mean(magnitudes, fmin(a, b), b);
+                        expected[c * p->number_of_bars + n] = e;
+                        largest = fmax(largest, e);
+                    }
+                }
+            }
+            free(window);
+            free(magnitudes);
+
+            char what[64];
+            snprintf(what, sizeof(what), "format %d, %d channels", format,
+                    channels);
+            if (p->bass_cut_off_bar < 1) {
+                fprintf(stderr, "dense: %s: no bass bars\n", what);
+                failures++;
+            }
+            for (int n = 0; n < p->number_of_bars * channels; n++) {
+                if (!(fabs(p->cava_bands[n] - expected[n]) < largest * 1e-9)) {
+                    fprintf(stderr, "dense: %s: bar %d is %.17g instead of "
+                            "%.17g\n", what, n, p->cava_bands[n], expected[n]);
+                    failures++;
+                    break;
+                }
+            }
+            cava_destroy(p);
+        }
+    }
+    return failures;
+}
+
+// the channels of a plan are analyzed independently of each other, so each
+// one's bars are exactly those of a mono plan fed that channel alone, with
+// either engine, on the worker pool and in high density mode
+static int test_channels(void) {
+    static const int channel_counts[] = { 2, 3, 6, CAVA_MAX_CHANNELS };
+    static const unsigned int rates[] = { 44100, 192000 };
+    static double in[BLOCK * CAVA_MAX_CHANNELS], mono[BLOCK];
+    static double out[MAX_OUT * 2], mono_out[MAX_OUT];
+    int failures = 0;
+    for (size_t r = 0; r < ARRAY_SIZE(rates); r++)
+    for (size_t k = 0; k < ARRAY_SIZE(channel_counts); k++)
+    for (int format = 0; format < 2; format++)
+    for (int variant = 0; variant < 4; variant++) {
+        int channels = channel_counts[k];
+        struct cava_options options = {
+            .number_of_bars = 40, .rate = rates[r], .channels = channels,
+            .noise_reduction = 0.77, .low_cut_off = 50, .high_cut_off = 10000,
+            .history_format = format,
+        };
+        if (variant == 1)
+            options.engine = CAVA_ENGINE_BIQUAD;
+        if (variant == 2) {
+            options.workers = CAVA_MAX_WORKERS;
+            options.parallel_fft_size = 16;
+        }
+        if (variant == 3) {
+            options.number_of_bars = 700;
+            options.high_density = 1;
+        }
+        struct cava_options mono_options = options;
+        mono_options.channels = 1;
+        struct cava_plan *p = plan_for(&options);
+        struct cava_plan *m[CAVA_MAX_CHANNELS];
+        if (p == NULL)
+            return 1;
+        for (int c = 0; c < channels; c++) {
+            if ((m[c] = plan_for(&mono_options)) == NULL)
+                return 1;
+        }
+
+        char what[64];
+        snprintf(what, sizeof(what), "%u Hz, %d channels, format %d, "
+                "variant %d", rates[r], channels, format, variant);
+        int bars = options.number_of_bars;
+        long t = 0;
+        for (int e = 0; e < 40; e++) {
+            next_frames(in, BLOCK, channels, &t);
+            cava_execute(in, BLOCK * channels, out, p);
+            int differ = 0;
+            for (int c = 0; c < channels && !differ; c++) {
+                for (int f = 0; f < BLOCK; f++)
+                    mono[f] = in[f * channels + c];
+                cava_execute(mono, BLOCK, mono_out, m[c]);
+                differ = differs("channels", what, mono_out, out + c * bars,
+                        bars);
+            }
+            if (differ) {
+                failures++;
+                break;
+            }
+        }
+        cava_destroy(p);
+        for (int c = 0; c < channels; c++)
+            cava_destroy(m[c]);
+    }
+    return failures;
+}
+
+// a plan that analyzes some of the channels of its input gives exactly the
+// bars of mono plans fed each of those channels, and with downmix those of a
+// mono plan fed their mean
+static int test_channel_mask(void) {
+    static const struct {
+        int channels;
+        unsigned int mask;
+    } selections[] = {
+        { 2, 0x1 }, { 2, 0x2 }, { 2, 0 }, { 3, 0x5 }, { 6, 0x3 },
+        { 6, 0x24 }, { 8, 0xa4 }, { 8, 0 },
+    };
+    static const unsigned int rates[] = { 44100, 192000 };
+    static double in[BLOCK * CAVA_MAX_CHANNELS], mono[BLOCK];
+    static double out[MAX_OUT], mono_out[MAX_OUT];
+    int failures = 0;
+    for (size_t r = 0; r < ARRAY_SIZE(rates); r++)
+    for (size_t k = 0; k < ARRAY_SIZE(selections); k++)
+    for (int format = 0; format < 2; format++)
+    for (int downmix = 0; downmix < 2; downmix++) {
+        int channels = selections[k].channels;
+        struct cava_options options = {
+            .number_of_bars = 40, .rate = rates[r], .channels = channels,
+            .noise_reduction = 0.77, .low_cut_off = 50, .high_cut_off = 10000,
+            .history_format = format, .channel_mask = selections[k].mask,
+            .downmix = downmix,
+        };
+        struct cava_options mono_options = options;
+        mono_options.channels = 1;
+        mono_options.channel_mask = 0;
+        mono_options.downmix = 0;
+
+        // the channels analyzed, in the order of the input
+        int selected[CAVA_MAX_CHANNELS], count = 0;
+        for (int c = 0; c < channels; c++) {
+            if (options.channel_mask == 0 || options.channel_mask & 1u << c)
+                selected[count++] = c;
+        }
+        int analyzed = downmix ? 1 : count;
+
+        char what[64];
+        snprintf(what, sizeof(what), "%u Hz, mask 0x%x of %d, format %d, "
+                "downmix %d", rates[r], options.channel_mask, channels, format,
+                downmix);
+        struct cava_plan *p = plan_for(&options);
+        struct cava_plan *m[CAVA_MAX_CHANNELS];
+        if (p == NULL)
+            return 1;
+        if (p->audio_channels != analyzed) {
+            fprintf(stderr, "channel mask: %s: %d channels analyzed instead "
+                    "of %d\n", what, p->audio_channels, analyzed);
+            return 1;
+        }
+        for (int a = 0; a < analyzed; a++) {
+            if ((m[a] = plan_for(&mono_options)) == NULL)
+                return 1;
+        }
+
+        int bars = options.number_of_bars;
+        long t = 0;
+        for (int e = 0; e < 30; e++) {
+            next_frames(in, BLOCK, channels, &t);
+            cava_execute(in, BLOCK * channels, out, p);
+            int differ = 0;
+            for (int a = 0; a < analyzed && !differ; a++) {
+                for (int f = 0; f < BLOCK; f++) {
+                    if (downmix) {
+                        double sum = 0;
+                        for (int i = 0; i < count; i++)
+                            sum += in[f * channels + selected[i]];
+                        mono[f] = count > 1 ? sum / count : sum;
+                    } else {
+                        mono[f] = in[f * channels + selected[a]];
+                    }
+                }
+                cava_execute(mono, BLOCK, mono_out, m[a]);
+                differ = differs("channel mask", what, mono_out,
+                        out + a * bars, bars);
+            }
+            if (differ) {
+                failures++;
+                break;
+            }
+        }
+        cava_destroy(p);
+        for (int a = 0; a < analyzed; a++)
+            cava_destroy(m[a]);
+    }
+
+    // a mask with channels the input does not have is refused
+    struct cava_options options = { .number_of_bars = 20, .rate = 48000,
+        .channels = 2, .noise_reduction = 0.77, .low_cut_off = 50,
+        .high_cut_off = 10000, .channel_mask = 0x4 };
+    struct cava_plan *p = cava_init_with_options(&options);
+    if (p->status != -1) {
+        fprintf(stderr, "channel mask: 0x4 of 2 channels was taken\n");
+        failures++;
+    }
+    cava_destroy(p);
+    return failures;
+}
+
+static const struct {
+    const char *name;
+    int (*run)(void);
+} tests[] = {
+    { "reconfigure", test_reconfigure },
+    { "inherit", test_inherit },
+    { "bass", test_bass },
+    { "goertzel", test_goertzel },
+    { "dense", test_dense },
+    { "channels", test_channels },
+    { "channel-mask", test_channel_mask },
+};
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s TEST\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    srand(1);
+    for (size_t i = 0; i < ARRAY_SIZE(tests); i++) {
+        if (strcmp(argv[1], tests[i].name) == 0)
+            return tests[i].run() ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+    fprintf(stderr, "no test named %s\n", argv[1]);
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,88 @@
+// Checks the FFT backend cavacore is built with against a direct DFT in long
+// double of random real samples.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "fft/fft.h"
+
+#define MAX_SIZE 4096
+
+// largest error of a bin, relative to the largest bin
+#define TOLERANCE 1e-14
+
+// the size / 2 + 1 bins of the DFT of in
+static void reference_dft(const double *in, int size, long double (*out)[2]) {
+    for (int k = 0; k <= size / 2; k++) {
+        long double re = 0, im = 0;
+        for (int n = 0; n < size; n++) {
+            // the angle reduced modulo the size, for the long double sin
+            long double a = -2 * 3.14159265358979323846264338327950288L *
+                (long double)((long)k * n % size) / size;
+            re += in[n] * cosl(a);
+            im += in[n] * sinl(a);
+        }
+        out[k][0] = re;
+        out[k][1] = im;
+    }
+}
+
+// the largest error of the bins, relative to the largest expected bin
+static double bin_error(const long double (*expected)[2], int size,
+        const cava_complex *bins) {
+    long double largest = 0, error = 0;
+    for (int k = 0; k <= size / 2; k++) {
+        for (int part = 0; part < 2; part++) {
+            long double e = fabsl(expected[k][part] - bins[k][part]);
+            largest = fmaxl(largest, fabsl(expected[k][part]));
+            error = fmaxl(error, e);
+        }
+    }
+    return error / largest;
+}
+
+int main(void) {
+    static long double expected[MAX_SIZE / 2 + 1][2];
+    double *in = NULL, *samples = NULL;
+    cava_complex *out = NULL;
+    if (posix_memalign((void **)&in, 64, MAX_SIZE * sizeof(double)) != 0 ||
+            posix_memalign((void **)&out, 64,
+                (MAX_SIZE / 2 + 1) * sizeof(cava_complex)) != 0 ||
+            (samples = malloc(MAX_SIZE * sizeof(double))) == NULL) {
+        fprintf(stderr, "could not allocate the buffers\n");
+        return EXIT_FAILURE;
+    }
+
+    int failures = 0;
+    srand(1);
+    for (int size = 16; size <= MAX_SIZE; size *= 2) {
+        for (int n = 0; n < size; n++)
+            samples[n] = (double)rand() / RAND_MAX - 0.5;
+        reference_dft(samples, size, expected);
+
+        struct cava_fft *fft = cava_fft_plan(size);
+        if (fft == NULL) {
+            fprintf(stderr, "%s: could not plan %d points\n", cava_fft_backend,
+                    size);
+            return EXIT_FAILURE;
+        }
+        // the FFT may clobber its input
+        for (int n = 0; n < size; n++)
+            in[n] = samples[n];
+        cava_fft_execute(fft, in, out);
+
+        double error = bin_error(expected, size, out);
+        if (!(error < TOLERANCE)) {
+            fprintf(stderr, "%s: %d points are off by %g\n",
+                    cava_fft_backend, size, error);
+            failures++;
+        }
+        cava_fft_destroy(fft);
+    }
+
+    free(in);
+    free(out);
+    free(samples);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
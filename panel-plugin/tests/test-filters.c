@@ -0,0 +1,142 @@
+// Checks that the linear-time smoothing filters give exactly the output of
+// the loops they replaced, which spread every bar to every other bar.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cava/util.h"
+#include "filters.h"
+
+#define MAX_BARS 700
+#define FRAMES 2000
+
+// monstercat_filter() before the spreading was made linear
+static void reference_monstercat(float *_bars, int _number_of_bars,
+        double monstercat) {
+    int z;
+    int m_y, de;
+    monstercat = (100.0 - (monstercat / 3.0)) / 100.0;
+    for (z = 0; z < _number_of_bars; z++) {
+        for (m_y = z - 1; m_y >= 0; m_y--) {
+            de = z - m_y;
+            _bars[m_y] = max(
+                    _bars[z] / pow(monstercat * 1.5, de), _bars[m_y]);
+        }
+        for (m_y = z + 1; m_y < _number_of_bars; m_y++) {
+            de = m_y - z;
+            _bars[m_y] = max(
+                    _bars[z] / pow(monstercat * 1.5, de), _bars[m_y]);
+        }
+    }
+}
+
+// the waves branch of monstercat_filter() before it was made linear
+static void reference_waves(float *_bars, int _number_of_bars, int height) {
+    int z;
+    int m_y, de;
+    float height_normalizer = 1.0;
+    if (height > 1000) {
+        height_normalizer = height / 912.76;
+    }
+    for (z = 0; z < _number_of_bars; z++) { // waves
+        _bars[z] = _bars[z] / 1.25;
+        for (m_y = z - 1; m_y >= 0; m_y--) {
+            de = z - m_y;
+            _bars[m_y] = max(
+                    _bars[z] - height_normalizer * pow(de, 2), _bars[m_y]);
+        }
+        for (m_y = z + 1; m_y < _number_of_bars; m_y++) {
+            de = m_y - z;
+            _bars[m_y] = max(
+                    _bars[z] - height_normalizer * pow(de, 2), _bars[m_y]);
+        }
+    }
+}
+
+// a frame of bars up to height pixels high, with runs of silent bars and of
+// whole pixels like scale_bars() and the clamping produce
+static void random_frame(float *bars, int count, int height) {
+    for (int n = 0; n < count; n++) {
+        switch (rand() % 4) {
+            case 0:
+                bars[n] = 0;
+                break;
+            case 1:
+                bars[n] = rand() % height;
+                break;
+            default:
+                bars[n] = (float)rand() / RAND_MAX * height;
+                break;
+        }
+    }
+}
+
+static int compare(const char *filter, const float *expected,
+        const float *bars, int count, double smoothing, int height) {
+    for (int n = 0; n < count; n++) {
+        if (memcmp(&expected[n], &bars[n], sizeof(float)) != 0) {
+            fprintf(stderr, "%s: %d bars, smoothing %g, height %d: bar %d "
+                    "is %.9g instead of %.9g\n", filter, count, smoothing,
+                    height, n, bars[n], expected[n]);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int test_monstercat(FilterScratch *f) {
+    static const double smoothing[] = { 1, 10, 33, 50, 75, 99, 100 };
+    static const int heights[] = { 30, 400, 999, 1440, 2160 };
+    float expected[MAX_BARS], bars[MAX_BARS];
+    int failures = 0;
+    for (int frame = 0; frame < FRAMES; frame++) {
+        // mostly few bars, where every bar reaches the others
+        int count = 1 + rand() % (frame % 4 ? 64 : MAX_BARS);
+        double s = smoothing[rand() % ARRAY_SIZE(smoothing)];
+        int height = heights[rand() % ARRAY_SIZE(heights)];
+        random_frame(expected, count, height);
+        memcpy(bars, expected, count * sizeof(float));
+        reference_monstercat(expected, count, s);
+        monstercat_filter(f, bars, count, 0, s, height);
+        failures += compare("monstercat", expected, bars, count, s, height);
+    }
+    return failures;
+}
+
+static int test_waves(FilterScratch *f) {
+    // the heights in pixels on both sides of the 1000 where the curve of the
+    // waves starts to scale with them
+    static const int heights[] = { 16, 30, 120, 400, 999, 1000, 1001, 1440,
+        2160, 4320 };
+    float expected[MAX_BARS], bars[MAX_BARS];
+    int failures = 0;
+    for (int frame = 0; frame < FRAMES; frame++) {
+        int count = 1 + rand() % (frame % 4 ? 64 : MAX_BARS);
+        int height = heights[rand() % ARRAY_SIZE(heights)];
+        // the smoothing only selects the filter, not how the waves spread
+        double s = 1 + rand() % 100;
+        random_frame(expected, count, height);
+        memcpy(bars, expected, count * sizeof(float));
+        reference_waves(expected, count, height);
+        monstercat_filter(f, bars, count, 1, s, height);
+        failures += compare("waves", expected, bars, count, s, height);
+    }
+    return failures;
+}
+
+int main(void) {
+    FilterScratch f;
+    if (filter_scratch_init(&f, MAX_BARS) == -1) {
+        fprintf(stderr, "could not allocate the filters\n");
+        return EXIT_FAILURE;
+    }
+    srand(1);
+    int failures = test_monstercat(&f);
+    failures += test_waves(&f);
+    filter_scratch_free(&f);
+    if (failures)
+        fprintf(stderr, "%d of %d frames differ\n", failures, 2 * FRAMES);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}